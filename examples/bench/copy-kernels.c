@@ -0,0 +1,67 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SIZE (16 * 1024 * 1024)
+#define ROUNDS 16
+
+static uint8_t in[SIZE];
+static uint8_t out[SIZE];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The copy loop every pair used before: one indirect call per read and per write.
+static uint64_t copy_dynamic(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz) {
+  uint64_t ttl = 0;
+  while (true) {
+    uint64_t rn = src->read(src, buf, sz);
+    if (rn == 0 && errno == QBS_EOF)
+      break;
+    assert(rn != 0);
+    assert(dst->write(dst, buf, rn) == rn);
+    ttl += rn;
+  }
+  return ttl;
+}
+
+static void bench(const char *name, int kind) {
+  uint8_t buf[512];
+  double start = now();
+
+  for (int i = 0; i < ROUNDS; i++) {
+    qbs_bytes_t r = {};
+    qbs_bytes_t w = {};
+    assert(qbs_bytes_reader(&r, in, sizeof(in)) == true);
+    assert(qbs_bytes_writer(&w, out, sizeof(out)) == true);
+
+    // A limit over bytes has its own specialized copy, selected at compile time.
+    qbs_limit_t l = {};
+    assert(qbs_io_add_limit(&l, &r.io, SIZE) == true);
+
+    uint64_t n = kind == 0   ? copy_dynamic(&r.io, &w.io, buf, sizeof(buf))
+                 : kind == 1 ? qbs_copy_buffer(&r, &w, buf, sizeof(buf))
+                             : qbs_copy_buffer(&l, &w, buf, sizeof(buf));
+    assert(n == SIZE);
+  }
+
+  double secs = now() - start;
+  printf("%-12s %8.1f MB/s\n", name, (double)SIZE * ROUNDS / secs / 1e6);
+}
+
+int main(void) {
+  for (uint64_t i = 0; i < SIZE; i++)
+    in[i] = (uint8_t)i;
+
+  bench("dynamic", 0);
+  bench("specialized", 1);
+  bench("limited", 2);
+  return 0;
+}
@@ -0,0 +1,77 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT 1000
+
+static uint8_t wire[64 * 1024];
+static uint8_t big[8 * 1024];
+
+int main(void) {
+  qbs_bytes_t w = {};
+  qbs_frame_writer_t fw = {};
+  uint8_t gather[1024];
+
+  // Small frames are gathered and written together, big ones go out with a gather write.
+  assert(qbs_bytes_writer(&w, wire, sizeof(wire)) == true);
+  assert(qbs_frame_writer(&fw, &w.io, QBS_FRAME_VARINT, sizeof(big), gather, sizeof(gather), 0, 0) == true);
+  for (int i = 0; i < COUNT; i++) {
+    char msg[32];
+    int n = snprintf(msg, sizeof(msg), "message %d", i);
+    assert(qbs_frame_write(&fw, (uint8_t *)msg, n) == true);
+  }
+  memset(big, 'b', sizeof(big));
+  assert(qbs_frame_write(&fw, big, sizeof(big)) == true);
+  assert(qbs_frame_write(&fw, big, sizeof(big) + 1) == false && errno == QBS_TOBIG);
+  assert(qbs_frame_flush(&fw) == true);
+
+  // A lone frame is flushed by polling once flush_ns has passed, without waiting for the next frame.
+  qbs_bytes_t lw = {};
+  qbs_frame_writer_t lfw = {};
+  uint8_t lone[64];
+  uint64_t next;
+  assert(qbs_bytes_writer(&lw, lone, sizeof(lone)) == true);
+  assert(qbs_frame_writer(&lfw, &lw.io, QBS_FRAME_VARINT, 16, gather, sizeof(gather), 0, 1000000) == true);
+  assert(qbs_frame_poll(&lfw, &next) == true && next == UINT64_MAX);
+  assert(qbs_frame_write(&lfw, (uint8_t *)"lone", 4) == true);
+  assert(qbs_frame_poll(&lfw, &next) == true && next <= 1000000 && lw.offset == 0);
+  struct timespec ts = {.tv_nsec = next};
+  nanosleep(&ts, 0);
+  assert(qbs_frame_poll(&lfw, &next) == true && next == UINT64_MAX && lw.offset == 5);
+
+  // A frame whose flush fails stays queued and is reported as queued, so callers do not queue it twice.
+  qbs_bytes_t sw = {};
+  qbs_frame_writer_t sfw = {};
+  uint8_t small[8];
+  assert(qbs_bytes_writer(&sw, small, sizeof(small)) == true);
+  assert(qbs_frame_writer(&sfw, &sw.io, QBS_FRAME_VARINT, 16, gather, sizeof(gather), 1, 0) == true);
+  assert(qbs_frame_write(&sfw, (uint8_t *)"0123456789", 10) == true);
+  assert(sw.offset + sfw.len == 11);
+  assert(qbs_frame_flush(&sfw) == false && sfw.len == 11 - sw.offset);
+
+  // Frames are parsed out of large reads and returned without copying.
+  qbs_bytes_t r = {};
+  qbs_frame_reader_t fr = {};
+  uint8_t scratch[sizeof(big) + 10];
+  assert(qbs_bytes_reader(&r, wire, w.offset) == true);
+  assert(qbs_frame_reader(&fr, &r.io, QBS_FRAME_VARINT, sizeof(big), scratch, sizeof(scratch)) == true);
+
+  uint8_t *frame;
+  uint64_t size;
+  for (int i = 0; i < COUNT; i++) {
+    char msg[32];
+    int n = snprintf(msg, sizeof(msg), "message %d", i);
+    assert(qbs_frame_next(&fr, &frame, &size) == true);
+    assert(size == (uint64_t)n && memcmp(frame, msg, n) == 0);
+  }
+  assert(qbs_frame_next(&fr, &frame, &size) == true);
+  assert(size == sizeof(big) && memcmp(frame, big, size) == 0);
+  assert(qbs_frame_next(&fr, &frame, &size) == false && errno == QBS_EOF);
+
+  return 0;
+}
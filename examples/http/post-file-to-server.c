@@ -15,7 +15,7 @@ int main(void) {
   assert(qbs_file_open(&f, "./assets/testfile.text", O_RDONLY) == false);
 
   qbs_sock_t s = {};
-  assert(qbs_http_post(&s, "127.0.0.1", 8080, route, sizeof(route) - 1, header, sizeof(header) - 1, &f.io) == false);
+  assert(qbs_http_post(&s, "localhost", 8080, route, sizeof(route) - 1, header, sizeof(header) - 1, &f.io) == false);
 
   uint8_t buff[2024] = {0};
   qbs_bytes_t b = {};
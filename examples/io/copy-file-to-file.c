@@ -0,0 +1,29 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+
+int main(void) {
+  qbs_file_t src = {};
+  qbs_file_t dst = {};
+
+  // File to file copies are done by the kernel with copy_file_range.
+  assert(qbs_file_open(&src, "./assets/testfile.text", O_RDONLY) == true);
+  assert(qbs_file_open(&dst, "/tmp/qbs-copy-file", O_RDWR | O_CREAT | O_TRUNC) == true);
+  assert(qbs_io_copy_n(&src.io, &dst.io, 100) == 100);
+  uint64_t rest = qbs_io_copy(&src.io, &dst.io);
+  assert(rest != 0);
+
+  uint8_t want[1024] = {0};
+  uint8_t got[1024] = {0};
+  assert(src.io.read_at(&src, want, sizeof(want), 0) == 100 + rest);
+  assert(dst.io.read_at(&dst, got, sizeof(got), 0) == 100 + rest);
+  assert(memcmp(want, got, 100 + rest) == 0);
+
+  dst.io.close(&dst);
+  src.io.close(&src);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SIZE (3 * 1024 * 1024 + 777)
+
+static uint8_t in[SIZE];
+static uint8_t out[SIZE];
+
+int main(void) {
+  for (uint64_t i = 0; i < SIZE; i++)
+    in[i] = (uint8_t)(i * 7);
+
+  // O_DIRECT streams bypass the page cache; the unaligned tail is stored on close.
+  qbs_bytes_t r = {};
+  qbs_file_t w = {};
+  assert(qbs_bytes_reader(&r, in, sizeof(in)) == true);
+  assert(qbs_file_open(&w, "/tmp/qbs-direct-stream", O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT) == true);
+  assert(qbs_io_copy(&r.io, &w.io) == SIZE);
+  assert(w.io.close(&w) == 0);
+
+  qbs_file_t f = {};
+  qbs_bytes_t b = {};
+  assert(qbs_file_open(&f, "/tmp/qbs-direct-stream", O_RDONLY | O_DIRECT) == true);
+  assert(qbs_bytes_writer(&b, out, sizeof(out)) == true);
+  assert(qbs_io_copy(&f.io, &b.io) == SIZE);
+  assert(memcmp(in, out, SIZE) == 0);
+  f.io.close(&f);
+
+  // Buffered streams can hint the kernel, throttle writeback and drop what was already consumed.
+  assert(qbs_bytes_reader(&r, in, sizeof(in)) == true);
+  assert(qbs_file_open(&w, "/tmp/qbs-direct-stream", O_WRONLY | O_TRUNC) == true);
+  assert(qbs_file_behind(&w, 256 * 1024) == true);
+  assert(qbs_io_copy(&r.io, &w.io) == SIZE);
+  w.io.close(&w);
+
+  memset(out, 0, sizeof(out));
+  assert(qbs_file_open(&f, "/tmp/qbs-direct-stream", O_RDONLY) == true);
+  assert(qbs_bytes_writer(&b, out, sizeof(out)) == true);
+  assert(qbs_file_advise(&f, 0, 0, POSIX_FADV_SEQUENTIAL) == true);
+  assert(qbs_file_behind(&f, 256 * 1024) == true);
+  assert(qbs_io_copy(&f.io, &b.io) == SIZE);
+  assert(memcmp(in, out, SIZE) == 0);
+  f.io.close(&f);
+
+  // File to file copies done by the kernel release the page cache of both files as well.
+  qbs_file_t c = {};
+  assert(qbs_file_open(&f, "/tmp/qbs-direct-stream", O_RDONLY) == true);
+  assert(qbs_file_open(&c, "/tmp/qbs-direct-stream-copy", O_WRONLY | O_CREAT | O_TRUNC) == true);
+  assert(qbs_file_behind(&f, 256 * 1024) == true);
+  assert(qbs_file_behind(&c, 256 * 1024) == true);
+  assert(qbs_io_copy(&f.io, &c.io) == SIZE);
+  assert(f.pos == SIZE && f.mark > 0);
+  assert(c.pos == SIZE && c.drop > 0);
+  c.io.close(&c);
+  f.io.close(&f);
+
+  return 0;
+}
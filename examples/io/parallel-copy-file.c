@@ -0,0 +1,40 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SIZE (4 * 1024 * 1024 + 123)
+
+static uint8_t in[SIZE];
+static uint8_t out[SIZE];
+
+int main(void) {
+  for (uint64_t i = 0; i < SIZE; i++)
+    in[i] = (uint8_t)(i * 31);
+
+  qbs_bytes_t r = {};
+  qbs_file_t w = {};
+  assert(qbs_bytes_reader(&r, in, sizeof(in)) == true);
+  assert(qbs_file_open(&w, "/tmp/qbs-parallel-copy", O_RDWR | O_CREAT | O_TRUNC) == true);
+
+  // Ranges of the source are copied by four threads at the same time.
+  assert(qbs_io_copy_parallel(&r.io, &w.io, 4, 64 * 1024) == SIZE);
+
+  // A section of the written file behaves like any other reader.
+  qbs_section_reader_t sec = {};
+  qbs_bytes_t b = {};
+  assert(qbs_section_reader(&sec, &w.io, 1000, 5000) == true);
+  assert(qbs_bytes_writer(&b, out, sizeof(out)) == true);
+  assert(qbs_io_copy(&sec.io, &b.io) == 5000);
+  assert(memcmp(out, in + 1000, 5000) == 0);
+
+  // And the whole file read back in parallel matches the source.
+  assert(qbs_io_copy_parallel(&w.io, &b.io, 3, 100 * 1000) == SIZE);
+  assert(memcmp(out, in, SIZE) == 0);
+
+  w.io.close(&w);
+  return 0;
+}
@@ -0,0 +1,78 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+
+int main(void) {
+  uint8_t data[10] = "0123456789";
+  uint8_t buff[8] = {0};
+  qbs_bytes_t r = {};
+  qbs_bytes_t w = {};
+  qbs_result_t res;
+
+  // The short final read carries EOF, no extra call is needed to learn the stream ended.
+  assert(qbs_bytes_reader(&r, data, sizeof(data)) == true);
+  res = qbs_io_result_read(&r.io, buff, sizeof(buff));
+  assert(res.n == 8 && res.err == 0 && !res.eof);
+  res = qbs_io_result_read(&r.io, buff, sizeof(buff));
+  assert(res.n == 2 && res.err == 0 && res.eof);
+
+  // Both APIs can be mixed on the same object: the legacy reader still reports EOF afterwards.
+  assert(r.io.read(&r, buff, sizeof(buff)) == 0 && errno == QBS_EOF);
+
+  // A copy into a too small buffer reports what was copied along with the error.
+  assert(qbs_bytes_reader(&r, data, sizeof(data)) == true);
+  assert(qbs_bytes_writer(&w, buff, sizeof(buff)) == true);
+  res = qbs_io_result_copy(&r.io, &w.io);
+  assert(res.n == 8 && res.err == -QBS_TOSMALL);
+  assert(memcmp(buff, data, 8) == 0);
+
+  // Limits end the stream with the last bytes they let through.
+  qbs_limit_t l = {};
+  assert(qbs_bytes_reader(&r, data, sizeof(data)) == true);
+  assert(qbs_io_add_limit(&l, &r.io, 4) == true);
+  res = qbs_io_result_read_full(&l.io, buff, 4);
+  assert(res.n == 4 && res.err == 0 && res.eof);
+  assert(l.io.read(&l, buff, 4) == 0 && errno == QBS_EOF);
+
+  assert(qbs_bytes_reader(&r, data, sizeof(data)) == true);
+  res = qbs_io_result_read_full(&r.io, buff, 4);
+  assert(res.n == 4 && res.err == 0 && !res.eof);
+  assert(qbs_bytes_writer(&w, buff, sizeof(buff)) == true);
+  res = qbs_io_result_copy_n(&r.io, &w.io, 8);
+  assert(res.n == 6 && res.err == -QBS_UNXEOF);
+
+  // Regular files know a short read is the end of file.
+  qbs_file_t f = {};
+  uint8_t text[4096] = {0};
+  assert(qbs_file_open(&f, "./assets/testfile.text", O_RDONLY) == true);
+  res = qbs_io_result_read(&f.io, text, sizeof(text));
+  assert(res.n != 0 && res.err == 0 && res.eof);
+  uint64_t size = res.n;
+  f.io.close(&f);
+
+  // Kernel copies report the same way.
+  qbs_file_t dst = {};
+  assert(qbs_file_open(&f, "./assets/testfile.text", O_RDONLY) == true);
+  assert(qbs_file_open(&dst, "/tmp/qbs-result-copy", O_WRONLY | O_CREAT | O_TRUNC) == true);
+  res = qbs_io_result_copy(&f.io, &dst.io);
+  assert(res.n == size && res.err == 0 && res.eof);
+  dst.io.close(&dst);
+  f.io.close(&f);
+
+  // So do O_DIRECT files, from their bounce buffer.
+  assert(qbs_file_open(&f, "./assets/testfile.text", O_RDONLY | O_DIRECT) == true);
+  res = qbs_io_result_read(&f.io, text, sizeof(text));
+  assert(res.n == size && res.err == 0 && res.eof);
+  f.io.close(&f);
+
+  // System errors keep their errno value, positive.
+  assert(qbs_file_open(&f, "/tmp", O_RDONLY) == true);
+  res = qbs_io_result_read(&f.io, text, sizeof(text));
+  assert(res.n == 0 && res.err == EISDIR && !res.eof);
+  f.io.close(&f);
+  return 0;
+}
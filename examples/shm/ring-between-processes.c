@@ -0,0 +1,70 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define TOTAL (64ull * 1024 * 1024)
+
+int main(void) {
+  int fd = -1;
+  assert(qbs_shm_create(&fd, 64 * 1024) == true);
+
+  pid_t pid = fork();
+  assert(pid != -1);
+
+  if (pid == 0) {
+    // The child fills the first half in place and streams the rest through the generic write slot.
+    qbs_shm_t w = {};
+    assert(qbs_shm_writer(&w, fd) == true);
+
+    uint64_t sent = 0;
+    while (sent < TOTAL / 2) {
+      uint64_t n = TOTAL / 2 - sent;
+      uint8_t *dst = qbs_shm_reserve(&w, &n);
+      assert(dst != 0);
+      for (uint64_t i = 0; i < n; i++)
+        dst[i] = (uint8_t)(sent + i);
+      assert(qbs_shm_commit(&w, n) == true);
+      sent += n;
+    }
+
+    uint8_t chunk[8192];
+    while (sent < TOTAL) {
+      for (uint64_t i = 0; i < sizeof(chunk); i++)
+        chunk[i] = (uint8_t)(sent + i);
+      assert(w.io.write(&w, chunk, sizeof(chunk)) == sizeof(chunk));
+      sent += sizeof(chunk);
+    }
+
+    w.io.close(&w);
+    return 0;
+  }
+
+  qbs_shm_t r = {};
+  assert(qbs_shm_reader(&r, fd) == true);
+
+  uint8_t buf[12345];
+  uint64_t got = 0;
+  for (;;) {
+    uint64_t n = r.io.read(&r, buf, sizeof(buf));
+    if (n == 0) {
+      assert(errno == QBS_EOF);
+      break;
+    }
+    for (uint64_t i = 0; i < n; i++)
+      assert(buf[i] == (uint8_t)(got + i));
+    got += n;
+  }
+  assert(got == TOTAL);
+
+  r.io.close(&r);
+  close(fd);
+
+  int status = 0;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return 0;
+}
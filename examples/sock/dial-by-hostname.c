@@ -0,0 +1,42 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+static void echo(const char *host, uint16_t port) {
+  qbs_listener_t l = {};
+  qbs_sock_t c = {};
+  qbs_sock_t s = {};
+  uint8_t buff[4] = {0};
+
+  assert(qbs_tcp_listen(&l, host, port) == true);
+  assert(qbs_tcp_dial(&c, host, port) == true);
+  assert(qbs_tcp_accept(&s, &l) == true);
+
+  assert(c.io.write(&c, (uint8_t *)"ping", 4) == 4);
+  assert(qbs_io_read_full(&s.io, buff, sizeof(buff)) == 4);
+  assert(memcmp(buff, "ping", 4) == 0);
+
+  s.io.close(&s);
+  c.io.close(&c);
+  close(l.sock);
+}
+
+int main(void) {
+  // Host names go through getaddrinfo once, then come from the resolver cache.
+  echo("localhost", 8081);
+  echo("localhost", 8082);
+  echo("127.0.0.1", 8083);
+
+  // IPv6 loopback, when the host has it.
+  qbs_addr_t a;
+  assert(qbs_resolve("::1", 8084, SOCK_STREAM, &a, 1) == 1 && a.addr.ss_family == AF_INET6);
+  qbs_listener_t l = {};
+  if (qbs_tcp_listen(&l, "::1", 8084)) {
+    close(l.sock);
+    echo("::1", 8084);
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define COUNT 32
+
+int main(void) {
+  qbs_udp_t srv = {};
+  qbs_udp_t cli = {};
+
+  assert(qbs_udp_bind(&srv, "127.0.0.1", 9090) == true);
+  assert(qbs_udp_dial(&cli, "127.0.0.1", 9090) == true);
+
+  // One datagram per read and write.
+  uint8_t buff[2048] = {0};
+  assert(cli.io.write(&cli, (uint8_t *)"ping", 4) == 4);
+  assert(srv.io.read(&srv, buff, sizeof(buff)) == 4);
+  assert(srv.io.write(&srv, (uint8_t *)"pong", 4) == 4);
+  assert(cli.io.read(&cli, buff, sizeof(buff)) == 4);
+  assert(memcmp(buff, "pong", 4) == 0);
+
+  // Many datagrams per syscall.
+  uint8_t out[COUNT][64];
+  uint8_t in[COUNT][64];
+  qbs_udp_msg_t send[COUNT] = {};
+  qbs_udp_msg_t recv[COUNT] = {};
+  for (int i = 0; i < COUNT; i++) {
+    memset(out[i], 'a' + (i % 26), sizeof(out[i]));
+    send[i] = (qbs_udp_msg_t){.buffer = out[i], .size = sizeof(out[i])};
+    recv[i] = (qbs_udp_msg_t){.buffer = in[i], .size = sizeof(in[i])};
+  }
+  assert(qbs_udp_send_batch(&cli, send, COUNT) == COUNT);
+
+  uint64_t got = 0;
+  while (got < COUNT) {
+    uint64_t n = qbs_udp_recv_batch(&srv, recv + got, COUNT - got);
+    assert(n != 0);
+    got += n;
+  }
+  for (int i = 0; i < COUNT; i++) {
+    assert(recv[i].size == sizeof(in[i]));
+    assert(memcmp(in[i], out[i], sizeof(in[i])) == 0);
+  }
+
+  // Datagrams larger than the buffer are reported instead of being cut short.
+  assert(cli.io.write(&cli, buff, 1500) == 1500);
+  assert(srv.io.read(&srv, buff, 512) == 0 && errno == QBS_TOSMALL);
+  assert(cli.io.write(&cli, buff, 100) == 100);
+  recv[0] = (qbs_udp_msg_t){.buffer = in[0], .size = sizeof(in[0])};
+  assert(qbs_udp_recv_batch(&srv, recv, 1) == 1);
+  assert(recv[0].truncated == true && recv[0].size == 100);
+
+  // One write split into four datagrams by the kernel.
+  assert(qbs_udp_set_gso(&cli, 256) == true);
+  memset(buff, 'z', 1024);
+  assert(cli.io.write(&cli, buff, 1024) == 1024);
+  for (int i = 0; i < 4; i++)
+    assert(srv.io.read(&srv, buff, sizeof(buff)) == 256);
+
+  cli.io.close(&cli);
+  srv.io.close(&srv);
+  return 0;
+}
@@ -0,0 +1,69 @@
+#define QBS_IMPL
+
+#include "../../qbs.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+
+int main(void) {
+  qbs_unix_listener_t l = {};
+  assert(qbs_unix_listen(&l, "@qbs-pass-file", SOCK_STREAM) == true);
+
+  pid_t pid = fork();
+  assert(pid != -1);
+
+  if (pid == 0) {
+    // The peer receives the open file and sends it back itself, without proxying the bytes.
+    qbs_unix_t c = {};
+    qbs_file_t f = {};
+
+    assert(qbs_unix_dial(&c, "@qbs-pass-file", SOCK_STREAM) == true);
+    assert(qbs_unix_recv_file(&c, &f) == true);
+    assert(qbs_io_copy(&f.io, &c.io) != 0);
+
+    f.io.close(&f);
+    c.io.close(&c);
+    return 0;
+  }
+
+  qbs_unix_t s = {};
+  qbs_file_t f = {};
+
+  assert(qbs_unix_accept(&s, &l) == true);
+  assert(qbs_file_open(&f, "./assets/testfile.text", O_RDONLY) == true);
+  assert(qbs_unix_send_file(&s, &f) == true);
+
+  uint8_t buff[4096] = {0};
+  qbs_bytes_t b = {};
+  assert(qbs_bytes_writer(&b, buff, sizeof(buff)));
+  uint64_t n = qbs_io_copy(&s.io, &b.io);
+  assert(n != 0);
+
+  int status;
+  assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  uint8_t want[4096] = {0};
+  assert(lseek(f.fd, 0, SEEK_SET) == 0);
+  assert(qbs_io_read_at_least(&f.io, want, sizeof(want), n) == n);
+  assert(memcmp(buff, want, n) == 0);
+
+  f.io.close(&f);
+  s.io.close(&s);
+
+  // SOCK_SEQPACKET keeps record boundaries; a record that does not fit the buffer is reported, not cut.
+  qbs_unix_listener_t pl = {};
+  qbs_unix_t pc = {};
+  qbs_unix_t ps = {};
+  assert(qbs_unix_listen(&pl, "@qbs-pass-records", SOCK_SEQPACKET) == true);
+  assert(qbs_unix_dial(&pc, "@qbs-pass-records", SOCK_SEQPACKET) == true);
+  assert(qbs_unix_accept(&ps, &pl) == true);
+  assert(pc.io.write(&pc, buff, 64) == 64);
+  assert(pc.io.write(&pc, buff, 16) == 16);
+  assert(ps.io.read(&ps, want, 32) == 0 && errno == QBS_TOSMALL);
+  assert(ps.io.read(&ps, want, 32) == 16);
+  pc.io.close(&pc);
+  ps.io.close(&ps);
+  return 0;
+}
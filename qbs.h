@@ -27,11 +27,61 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
 #ifndef QBSDEF
 #define QBSDEF static inline
 #endif
 
+#ifndef QBS_NOINLINE
+#if defined(__GNUC__)
+#define QBS_NOINLINE __attribute__((noinline))
+#else
+#define QBS_NOINLINE
+#endif
+#endif
+
+#ifndef QBS_UDP_BATCH
+#define QBS_UDP_BATCH 64 // Maximum number of datagrams moved by a single recvmmsg/sendmmsg call.
+#endif
+
+#ifndef QBS_UNIX_MAX_FDS
+#define QBS_UNIX_MAX_FDS 16 // Maximum number of file descriptors passed in a single message.
+#endif
+
+#ifndef QBS_RESOLVER_ADDRS
+#define QBS_RESOLVER_ADDRS 8 // Maximum number of addresses kept per resolved host.
+#endif
+
+#ifndef QBS_RESOLVER_SLOTS
+#define QBS_RESOLVER_SLOTS 64 // Number of hosts kept in the resolver cache.
+#endif
+
+#ifndef QBS_RESOLVER_TTL
+#define QBS_RESOLVER_TTL 30 // Seconds a resolved host stays in the resolver cache.
+#endif
+
+#ifndef QBS_DIAL_STAGGER
+#define QBS_DIAL_STAGGER 250 // Milliseconds qbs_tcp_dial waits for an attempt before starting the next one in parallel.
+#endif
+
+#ifndef QBS_DIRECT_ALIGN
+#define QBS_DIRECT_ALIGN 4096 // Alignment of O_DIRECT buffers, offsets and sizes.
+#endif
+
+#ifndef QBS_DIRECT_BUFFER
+#define QBS_DIRECT_BUFFER (1024 * 1024) // Size of the bounce buffer of files opened with O_DIRECT.
+#endif
+
+#ifndef QBS_ZEROCOPY_PENDING
+#define QBS_ZEROCOPY_PENDING 64 // Maximum number of zero-copy writes awaiting completion per socket.
+#endif
+
+#ifndef QBS_PARALLEL_THREADS
+#define QBS_PARALLEL_THREADS 64 // Maximum number of threads used by qbs_io_copy_parallel, including the caller.
+#endif
+
 /*
  * @brief Error codes that errno will be set to if an error is detected by the library.
  */
@@ -43,11 +93,26 @@ typedef enum {
   QBS_TOBIG = 4,
   QBS_NOMETH = 5,
   QBS_PARTW = 6,
+  QBS_NOADDR = 7,
 } qbs_error_t;
 
+/*
+ * @brief Outcome of a read, write or copy from the result API: progress and how the call ended, together.
+ */
+typedef struct {
+  uint64_t n;  // Bytes processed, also when err or eof is set.
+  int32_t err; // 0 on success, a system errno value if positive, a negated qbs_error_t if negative.
+  bool eof;    // True if the stream source has no bytes left after these n.
+} qbs_result_t;
+
 typedef uint64_t (*qbs_io_read)(void *ctx, uint8_t *bytes, uint64_t size);
 typedef uint64_t (*qbs_io_write)(void *ctx, uint8_t *bytes, uint64_t size);
 typedef uint16_t (*qbs_io_close)(void *ctx);
+typedef uint64_t (*qbs_io_read_at)(void *ctx, uint8_t *bytes, uint64_t size, uint64_t off);
+typedef uint64_t (*qbs_io_write_at)(void *ctx, uint8_t *bytes, uint64_t size, uint64_t off);
+typedef qbs_result_t (*qbs_io_writev)(void *ctx, struct iovec *iov, int cnt);
+typedef qbs_result_t (*qbs_io_read_result)(void *ctx, uint8_t *bytes, uint64_t size);
+typedef qbs_result_t (*qbs_io_write_result)(void *ctx, uint8_t *bytes, uint64_t size);
 
 /*
  * @brief QBS object. This struct must exist within structs intended for use as stream sources.
@@ -56,6 +121,11 @@ typedef struct {
   qbs_io_read read;   // If the stream source does not implement a reader, set this to qbs_io_invalid_rw.
   qbs_io_write write; // If the stream source does not implement a writer, set this to qbs_io_invalid_rw.
   qbs_io_close close; // If the stream source does not implement a closer, set this to qbs_io_invalid_close.
+  qbs_io_read_at read_at;   // Optional positional reader; NULL if the stream source has no random access.
+  qbs_io_write_at write_at; // Optional positional writer; NULL if the stream source has no random access.
+  qbs_io_writev writev;     // Optional gather writer of the result API, writing every buffer or failing; NULL if not implemented.
+  qbs_io_read_result read_result;   // Optional reader of the result API; NULL to adapt read.
+  qbs_io_write_result write_result; // Optional writer of the result API, writing everything or failing; NULL to adapt write.
 } qbs_io_t;
 
 /*
@@ -71,18 +141,77 @@ typedef struct {
   bool is_completed; // True if the limit has been reached.
 } qbs_limit_t;
 
+/*
+ * @brief A stream source that exposes a byte range of another stream source as a normal reader.
+ *
+ * @note This struct should only be constructed via qbs_section_reader.
+ */
+typedef struct {
+  qbs_io_t io;     // QBS object (reader and positional reader implemented).
+  qbs_io_t *r;     // Pointer to the underlying QBS stream source; must implement read_at.
+  uint64_t base;   // Offset of the section within the underlying stream source.
+  uint64_t offset; // Current read offset, relative to base.
+  uint64_t limit;  // Size of the section; errno is set to EOF once offset reaches it.
+} qbs_section_reader_t;
+
 /*
  * @brief A stream source for handling files.
  *
- * @note This struct should only be constructed via qbs_file_open.
+ * @note This struct should only be constructed via qbs_file_open or qbs_file_from_fd.
  */
 typedef struct {
   qbs_io_t io;          // QBS object; reader/writer set to qbs_io_invalid_rw based on open mode.
-  const char *filename; // The filename provided by the user.
+  const char *filename; // The filename provided by the user; NULL if constructed from a file descriptor.
   int mode;             // File opening mode provided by the user.
   int fd;               // The file descriptor returned from the open function.
+  uint8_t *direct;      // Aligned bounce buffer if opened with O_DIRECT, NULL otherwise.
+  uint64_t dlen;        // Number of valid bytes in the bounce buffer.
+  uint64_t dpos;        // Number of bytes of the bounce buffer already handed to the reader.
+  bool is_completed;    // True once an O_DIRECT read returned a short block (end of file).
+  bool regular;         // True for regular files, where a short read means the end of file was reached.
+  uint64_t behind;      // Window set by qbs_file_behind; 0 if disabled.
+  uint64_t pos;         // File offset of the next byte streamed through the adapter (only tracked if behind != 0).
+  uint64_t mark;        // Offset up to which written pages were handed to writeback or read pages were dropped.
+  uint64_t drop;        // Offset up to which written pages were waited on and dropped from the page cache.
 } qbs_file_t;
 
+/*
+ * @brief Called once the kernel no longer references a buffer given to qbs_tcp_write_zc.
+ *
+ * @param arg    The argument given along with the buffer.
+ * @param buf    The buffer, which may be reused or freed from now on.
+ * @param size   Size of the buffer.
+ * @param copied True if the kernel copied the data instead of sending it from the buffer.
+ */
+typedef void (*qbs_zc_release)(void *arg, const uint8_t *buf, uint64_t size, bool copied);
+
+/*
+ * @brief A buffer handed to the kernel by a zero-copy write, released once all its sends completed.
+ */
+typedef struct {
+  qbs_zc_release release; // Callback invoked on completion, may be NULL.
+  void *arg;              // Argument given to release.
+  const uint8_t *buf;     // The buffer.
+  uint64_t size;          // Size of the buffer.
+  uint32_t first;         // Notification id of the first send from the buffer.
+  uint32_t sends;         // Number of MSG_ZEROCOPY sends from the buffer.
+  uint32_t left;          // Number of sends from the buffer not completed yet.
+  bool copied;            // True if any of the sends was copied by the kernel.
+} qbs_zc_pending_t;
+
+/*
+ * @brief Zero-copy send state of a socket, allocated by qbs_tcp_zerocopy.
+ */
+typedef struct {
+  uint64_t threshold;                             // Writes smaller than this are copied as usual.
+  uint64_t zerocopied;                            // Bytes sent from the caller's buffers.
+  uint64_t copied;                                // Bytes the kernel fell back to copying.
+  uint32_t next;                                  // Notification id of the next MSG_ZEROCOPY send.
+  uint32_t head;                                  // Index of the oldest pending buffer.
+  uint32_t count;                                 // Number of pending buffers.
+  qbs_zc_pending_t pending[QBS_ZEROCOPY_PENDING]; // Buffers awaiting completion, in send order.
+} qbs_zc_t;
+
 /*
  * @brief A stream source for handling TCP connections.
  *
@@ -93,6 +222,7 @@ typedef struct {
   const char *address; // The address provided by the user.
   uint16_t port;       // The port provided by the user.
   int sock;            // The file descriptor returned by accept or connect functions.
+  qbs_zc_t *zc;        // Zero-copy send state, NULL unless enabled with qbs_tcp_zerocopy.
 } qbs_sock_t;
 
 /*
@@ -101,10 +231,72 @@ typedef struct {
  * @note This struct should only be constructed via qbs_tcp_listen.
  */
 typedef struct {
-  int sock;                   // File descriptor returned by the socket function.
-  struct sockaddr_in address; // The address to listen on.
+  int sock;                        // File descriptor returned by the socket function.
+  struct sockaddr_storage address; // The address to listen on (IPv4 or IPv6).
+  socklen_t addrlen;               // Size of address.
 } qbs_listener_t;
 
+/*
+ * @brief A resolved socket address.
+ */
+typedef struct {
+  struct sockaddr_storage addr; // IPv4 or IPv6 address, port included.
+  socklen_t addrlen;            // Size of addr.
+} qbs_addr_t;
+
+/*
+ * @brief A stream source for handling Unix domain socket connections (SOCK_STREAM or SOCK_SEQPACKET).
+ *
+ * @note This struct should only be constructed via qbs_unix_accept or qbs_unix_dial. With SOCK_SEQPACKET, a record
+ *       larger than the read buffer is dropped and the read fails with QBS_TOSMALL.
+ */
+typedef struct {
+  qbs_io_t io;      // QBS object; with SOCK_SEQPACKET every read and write is one record.
+  const char *path; // The path provided by the user; a leading '@' selects the abstract namespace.
+  int type;         // Socket type, SOCK_STREAM or SOCK_SEQPACKET.
+  int sock;         // The file descriptor returned by accept or connect functions.
+} qbs_unix_t;
+
+/*
+ * @brief Unix domain socket listener context.
+ *
+ * @note This struct should only be constructed via qbs_unix_listen.
+ */
+typedef struct {
+  int sock;                   // File descriptor returned by the socket function.
+  int type;                   // Socket type, SOCK_STREAM or SOCK_SEQPACKET.
+  struct sockaddr_un address; // The address to listen on.
+  socklen_t addrlen;          // Size of address; abstract addresses are not NUL terminated.
+} qbs_unix_listener_t;
+
+/*
+ * @brief A stream source for handling UDP datagrams; every read returns one datagram and every write sends one.
+ *
+ * @note This struct should only be constructed via qbs_udp_bind or qbs_udp_dial. A datagram larger than the
+ *       read buffer is dropped and the read fails with QBS_TOSMALL, rather than returning part of it.
+ */
+typedef struct {
+  qbs_io_t io;                  // QBS object.
+  const char *address;          // The address provided by the user.
+  uint16_t port;                // The port provided by the user.
+  int sock;                     // The file descriptor returned by the socket function.
+  bool is_connected;            // True if constructed via qbs_udp_dial; writes go to the dialed peer.
+  struct sockaddr_storage peer; // Sender of the last datagram read; unconnected writes reply to it.
+  socklen_t peerlen;            // Size of peer; 0 until the first datagram is read.
+} qbs_udp_t;
+
+/*
+ * @brief A datagram slot used by qbs_udp_recv_batch and qbs_udp_send_batch.
+ */
+typedef struct {
+  uint8_t *buffer;              // Datagram payload.
+  uint64_t size;                // Capacity of buffer when receiving (set to the received length), payload length when sending.
+  uint16_t segment;             // GSO/GRO segment size; 0 if buffer holds a single datagram.
+  struct sockaddr_storage addr; // Peer address; filled when receiving, destination when sending on unconnected sockets.
+  socklen_t addrlen;            // Size of addr; 0 when sending means the connected peer.
+  bool truncated;               // Set when receiving if the datagram did not fit in buffer; size is then its full length.
+} qbs_udp_msg_t;
+
 /*
  * @brief A stream source for handling byte arrays and buffers.
  *
@@ -118,6 +310,62 @@ typedef struct {
   bool is_completed; // True if the offset has reached the capacity.
 } qbs_bytes_t;
 
+/*
+ * @brief Length prefix encodings supported by the frame reader and writer.
+ */
+typedef enum {
+  QBS_FRAME_VARINT = 0,  // Unsigned LEB128 length, 1 to 10 bytes.
+  QBS_FRAME_FIXED32 = 1, // 4 byte big endian length.
+} qbs_frame_prefix_t;
+
+/*
+ * @brief A stream source that queues length-prefixed frames and writes many of them at once.
+ *
+ * @note This struct should only be constructed via qbs_frame_writer.
+ */
+typedef struct {
+  qbs_io_t io;               // QBS object (writer only); every write queues one frame.
+  qbs_io_t *w;               // Pointer to the underlying QBS stream source frames are written to.
+  qbs_frame_prefix_t prefix; // Length prefix encoding.
+  uint64_t max_frame;        // Frames bigger than this are rejected with QBS_TOBIG.
+  uint8_t *buffer;           // Caller-provided buffer where queued frames are gathered.
+  uint64_t capacity;         // Size of the buffer.
+  uint64_t len;              // Number of queued bytes, prefixes included.
+  uint64_t flush_bytes;      // Queued size that triggers a flush; 0 flushes only when the buffer is full.
+  uint64_t flush_ns;         // Age of the oldest queued frame that triggers a flush; 0 disables it.
+  uint64_t since;            // CLOCK_MONOTONIC time, in nanoseconds, the oldest queued frame was queued at.
+} qbs_frame_writer_t;
+
+/*
+ * @brief A stream source that parses length-prefixed frames out of large reads.
+ *
+ * @note This struct should only be constructed via qbs_frame_reader.
+ */
+typedef struct {
+  qbs_io_t io;               // QBS object (reader only); every read returns one frame.
+  qbs_io_t *r;               // Pointer to the underlying QBS stream source frames are read from.
+  qbs_frame_prefix_t prefix; // Length prefix encoding.
+  uint64_t max_frame;        // Frames bigger than this are rejected with QBS_TOBIG.
+  uint8_t *buffer;           // Caller-provided buffer frames are read into; returned frames point inside it.
+  uint64_t capacity;         // Size of the buffer.
+  uint64_t start;            // Offset of the first byte not yet returned.
+  uint64_t end;              // Offset past the last byte read.
+} qbs_frame_reader_t;
+
+/*
+ * @brief One end of a single-producer single-consumer byte ring living in a memfd shared between processes.
+ *
+ * @note This struct should only be constructed via qbs_shm_reader or qbs_shm_writer.
+ */
+typedef struct {
+  qbs_io_t io;       // QBS object; reader or writer implemented depending on the constructor.
+  int fd;            // The memfd the ring lives in; not owned by the object.
+  uint8_t *map;      // Mapping of the whole memfd, control block included.
+  uint64_t mapsize;  // Size of the mapping.
+  uint8_t *data;     // Ring storage, right after the control block.
+  uint64_t capacity; // Size of the ring storage, a power of two.
+} qbs_shm_t;
+
 /*
  * @brief Copies a stream of data from src to dst. Similar to qbs_io_copy_buffer but uses an internal buffer.
  *
@@ -159,6 +407,23 @@ QBSDEF uint64_t qbs_io_copy_buffer(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, u
  */
 QBSDEF uint64_t qbs_io_copy_n(qbs_io_t *src, qbs_io_t *dst, uint64_t n);
 
+/*
+ * @brief Copies src to dst by splitting the stream into chunks copied concurrently with read_at/write_at.
+ *
+ * @param src      QBS IO object implementing the positional reader interface.
+ * @param dst      QBS IO object implementing the positional writer interface.
+ * @param nthreads Number of threads copying at the same time, including the calling thread; capped at
+ *                 QBS_PARALLEL_THREADS.
+ * @param chunk    Size of each range handed to a thread.
+ *
+ * @return the size of the processed buffer
+ * @retval == 0 : if error occurred.
+ * @retval != 0 : the lenght of the processed buffer.
+ *
+ * @note Data is copied from offset 0 of src to the same offset of dst; sequential offsets are left untouched.
+ */
+QBSDEF uint64_t qbs_io_copy_parallel(qbs_io_t *src, qbs_io_t *dst, uint32_t nthreads, uint64_t chunk);
+
 /*
  * @brief Reads at least 'min' bytes from the data source into the provided buffer.
  *
@@ -190,6 +455,59 @@ QBSDEF uint64_t qbs_io_read_at_least(qbs_io_t *r, uint8_t *b, uint64_t sz, uint6
  */
 QBSDEF uint64_t qbs_io_read_full(qbs_io_t *r, uint8_t *b, uint64_t sz);
 
+/*
+ * @brief Reads from the reader into the buffer, returning the bytes read along with EOF or the error.
+ *
+ * @param r    QBS IO object implementing the reader interface.
+ * @param b    Buffer to copy data into.
+ * @param sz   Size of the buffer (b).
+ *
+ * @return the bytes read; eof is set with the last bytes when the stream source can tell, otherwise with n == 0.
+ *
+ * @note Stream sources without read_result are adapted from read and errno, where the library codes
+ *       (1 to QBS_NOADDR) cannot be told apart from the system errno values they overlap with.
+ */
+QBSDEF qbs_result_t qbs_io_result_read(qbs_io_t *r, uint8_t *b, uint64_t sz);
+
+/*
+ * @brief Writes the whole buffer to the writer, returning the bytes written along with the error if any.
+ *
+ * @param w    QBS IO object implementing the writer interface.
+ * @param b    Buffer to write.
+ * @param sz   Size of the buffer (b).
+ *
+ * @return the bytes written; n < sz only together with an error.
+ */
+QBSDEF qbs_result_t qbs_io_result_write(qbs_io_t *w, uint8_t *b, uint64_t sz);
+
+/*
+ * @brief Copies a stream of data from src to dst until src ends, see qbs_io_copy.
+ *
+ * @return the bytes copied, also when an error stopped the copy; eof is set once src is drained.
+ */
+QBSDEF qbs_result_t qbs_io_result_copy(qbs_io_t *src, qbs_io_t *dst);
+
+/*
+ * @brief Copies a stream of data from src to dst using a user-provided buffer, see qbs_io_copy_buffer.
+ *
+ * @return the bytes copied, also when an error stopped the copy; eof is set once src is drained.
+ */
+QBSDEF qbs_result_t qbs_io_result_copy_buffer(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz);
+
+/*
+ * @brief Copies n bytes from src to dst, see qbs_io_copy_n.
+ *
+ * @return the bytes copied; err is -QBS_UNXEOF if src ended before n bytes.
+ */
+QBSDEF qbs_result_t qbs_io_result_copy_n(qbs_io_t *src, qbs_io_t *dst, uint64_t n);
+
+/*
+ * @brief Reads data from the reader until the buffer is full, see qbs_io_read_full.
+ *
+ * @return the bytes read; err is -QBS_UNXEOF if the stream source ended before the buffer was filled.
+ */
+QBSDEF qbs_result_t qbs_io_result_read_full(qbs_io_t *r, uint8_t *b, uint64_t sz);
+
 /*
  * @brief Creates a new QBS object that limits its reader to a specific byte count.
  *
@@ -201,6 +519,18 @@ QBSDEF uint64_t qbs_io_read_full(qbs_io_t *r, uint8_t *b, uint64_t sz);
  */
 QBSDEF bool qbs_io_add_limit(qbs_limit_t *out, qbs_io_t *r, uint64_t limit);
 
+/*
+ * @brief Creates a new QBS object that reads the range [off, off + n) of another stream source.
+ *
+ * @param out Pointer to the qbs_section_reader_t to be initialized.
+ * @param r   The source QBS IO object; must implement read_at.
+ * @param off Offset of the first byte of the section.
+ * @param n   Size of the section.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_section_reader(qbs_section_reader_t *out, qbs_io_t *r, uint64_t off, uint64_t n);
+
 /*
  * @brief Creates a new QBS object with a reader for a specific byte buffer.
  *
@@ -234,6 +564,48 @@ QBSDEF bool qbs_bytes_writer(qbs_bytes_t *out, uint8_t *buffer, uint64_t size);
  */
 QBSDEF bool qbs_file_open(qbs_file_t *out, const char *filename, int mode);
 
+/*
+ * @brief Creates a new QBS object for an already open file descriptor; the object takes ownership of fd.
+ *
+ * @param out  Pointer to the qbs_file_t to be initialized.
+ * @param fd   An open file descriptor.
+ * @param mode The flags fd was opened with (defines if reader or writer is implemented).
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note With O_DIRECT in mode the file is streamed through an aligned bounce buffer of QBS_DIRECT_BUFFER bytes;
+ *       it must be opened either O_RDONLY or O_WRONLY, has no read_at/write_at, and the unaligned tail of a
+ *       written file is only stored by io.close.
+ */
+QBSDEF bool qbs_file_from_fd(qbs_file_t *out, int fd, int mode);
+
+/*
+ * @brief Gives the kernel a hint about how a range of the file will be accessed (posix_fadvise).
+ *
+ * @param f      A QBS file object.
+ * @param off    Offset of the range.
+ * @param len    Size of the range; 0 means up to the end of the file.
+ * @param advice POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED, ...
+ *
+ * @return True if the hint was accepted, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_file_advise(qbs_file_t *f, uint64_t off, uint64_t len, int advice);
+
+/*
+ * @brief Keeps at most about one window of streamed data in the page cache behind the current position.
+ *
+ * @param f      A QBS file object.
+ * @param window Size of the window in bytes; 0 disables the behavior.
+ *
+ * @return True if enabled successfully, otherwise errors can be found in errno.
+ *
+ * @note Read pages are dropped (POSIX_FADV_DONTNEED) once consumed. Written pages start writeback with
+ *       sync_file_range once a window is full, and the window before it is waited on and dropped, which
+ *       throttles the writer to the device speed. Only applies to io.read, io.write and the kernel copies of
+ *       qbs_io_copy (which then move one window at a time), without O_DIRECT.
+ */
+QBSDEF bool qbs_file_behind(qbs_file_t *f, uint64_t window);
+
 /*
  * @brief Creates a new QBS object to handle an accepted TCP client connection.
  *
@@ -248,13 +620,79 @@ QBSDEF bool qbs_tcp_accept(qbs_sock_t *out, qbs_listener_t *l);
  * @brief Creates a new QBS object and connects to a remote TCP server.
  *
  * @param out     Pointer to the qbs_sock_t to be initialized.
- * @param address The target server address.
+ * @param address The target server host name, IPv4 or IPv6 address.
  * @param port    The target server port.
  *
  * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note Addresses are tried alternating between IPv6 and IPv4; a new attempt starts every QBS_DIAL_STAGGER
+ *       milliseconds (or as soon as one fails) while the previous ones keep going, and the first to connect wins.
  */
 QBSDEF bool qbs_tcp_dial(qbs_sock_t *out, const char *address, uint16_t port);
 
+/*
+ * @brief Enables zero-copy sends (SO_ZEROCOPY) on a TCP connection.
+ *
+ * @param s         A QBS TCP object.
+ * @param threshold Writes of fewer bytes are copied as usual, pinning pages only pays off for large buffers.
+ *
+ * @return True if enabled successfully, otherwise errors can be found in errno.
+ *
+ * @note io.write then sends large buffers with MSG_ZEROCOPY and waits for their completion before returning;
+ *       use qbs_tcp_write_zc to keep sending while the kernel still references earlier buffers.
+ */
+QBSDEF bool qbs_tcp_zerocopy(qbs_sock_t *s, uint64_t threshold);
+
+/*
+ * @brief Sends a whole buffer without copying it, releasing it asynchronously.
+ *
+ * @param s       A QBS TCP object with zero-copy enabled.
+ * @param b       The buffer, which must stay untouched until released.
+ * @param sz      Size of the buffer.
+ * @param release Callback invoked once the kernel no longer references the buffer, may be NULL.
+ * @param arg     Argument given to release.
+ *
+ * @return True if sent successfully, otherwise errors can be found in errno.
+ *
+ * @note Buffers below the threshold are copied and released right away. Blocks reaping completions while
+ *       QBS_ZEROCOPY_PENDING buffers are pending. Falls back to copying when the kernel runs out of
+ *       pinned memory (ENOBUFS) and nothing is pending.
+ */
+QBSDEF bool qbs_tcp_write_zc(qbs_sock_t *s, const uint8_t *b, uint64_t sz, qbs_zc_release release, void *arg);
+
+/*
+ * @brief Reads the completions from the socket error queue and releases the buffers they finish.
+ *
+ * @param s    A QBS TCP object with zero-copy enabled.
+ * @param wait Blocks until every pending buffer is released if true.
+ *
+ * @return True if reaped successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_tcp_zerocopy_reap(qbs_sock_t *s, bool wait);
+
+/*
+ * @brief Resolves a host name, IPv4 or IPv6 address, with a cache shared by the threads of the process.
+ *
+ * @param host     Host to resolve; NULL or "" resolves the wildcard addresses to bind to.
+ * @param port     Port stored in the resolved addresses.
+ * @param socktype SOCK_STREAM or SOCK_DGRAM.
+ * @param out      Array receiving the addresses, in the order getaddrinfo prefers them.
+ * @param n        Capacity of out.
+ *
+ * @return the number of resolved addresses
+ * @retval == 0 : if error occurred, QBS_NOADDR if the host could not be resolved.
+ * @retval != 0 : the number of addresses stored in out.
+ *
+ * @note Literal addresses never reach getaddrinfo. Host names are cached for QBS_RESOLVER_TTL seconds,
+ *       in one cache per translation unit defining QBS_IMPL.
+ */
+QBSDEF uint32_t qbs_resolve(const char *host, uint16_t port, int socktype, qbs_addr_t *out, uint32_t n);
+
+/*
+ * @brief Drops every host from the resolver cache.
+ */
+QBSDEF void qbs_resolve_flush(void);
+
 /*
  * @brief Performs an HTTP GET request.
  *
@@ -277,71 +715,657 @@ QBSDEF bool qbs_http_post(qbs_sock_t *out, const char *address, uint16_t port, c
  * @brief Creates a TCP listener that manages client connections as QBS IO objects.
  *
  * @param out     Pointer to the qbs_listener_t to be initialized.
- * @param address The address to bind to.
+ * @param address The host name, IPv4 or IPv6 address to bind to; NULL or "" binds to every address.
  * @param port    The port to listen on.
  *
  * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note A single socket is bound: IPv4 addresses are tried first, so a host name such as "localhost" listens
+ *       where IPv4 clients dial it, and the first address that binds is used.
  */
 QBSDEF bool qbs_tcp_listen(qbs_listener_t *out, const char *address, uint16_t port);
 
-#endif // !QBS_H_
-
-#ifdef QBS_IMPL
-
-#include <arpa/inet.h>
-#include <assert.h>
-#include <fcntl.h>
-#include <unistd.h>
+/*
+ * @brief Creates a Unix domain socket listener that manages client connections as QBS IO objects.
+ *
+ * @param out  Pointer to the qbs_unix_listener_t to be initialized.
+ * @param path The socket path; a leading '@' selects the abstract namespace.
+ * @param type SOCK_STREAM or SOCK_SEQPACKET.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_unix_listen(qbs_unix_listener_t *out, const char *path, int type);
 
-#define qbs_io_min(a, b) (((a) < (b)) ? (a) : (b))
+/*
+ * @brief Creates a new QBS object to handle an accepted Unix domain socket connection.
+ *
+ * @param out Pointer to the qbs_unix_t to be initialized.
+ * @param l   A QBS Unix listener object.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_unix_accept(qbs_unix_t *out, qbs_unix_listener_t *l);
 
-QBSDEF uint64_t qbs_io_invalid_rw(void *ctx, uint8_t *bytes, uint64_t size) {
-  assert(0 && "unreachable");
-  assert(ctx == 0);
-  assert(bytes == 0);
-  assert(size == 0);
-  errno = QBS_NOMETH;
-  return 0;
-}
+/*
+ * @brief Creates a new QBS object and connects to a Unix domain socket.
+ *
+ * @param out  Pointer to the qbs_unix_t to be initialized.
+ * @param path The socket path; a leading '@' selects the abstract namespace.
+ * @param type SOCK_STREAM or SOCK_SEQPACKET.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_unix_dial(qbs_unix_t *out, const char *path, int type);
 
-QBSDEF uint16_t qbs_io_invalid_close(void *ctx) {
-  assert(0 && "unreachable");
-  assert(ctx == 0);
-  errno = QBS_NOMETH;
-  return 0;
-}
+/*
+ * @brief Sends file descriptors to the peer (SCM_RIGHTS), attached to a single marker byte.
+ *
+ * @param u   A QBS Unix object.
+ * @param fds The file descriptors to pass; the caller keeps its own copies open.
+ * @param n   Number of descriptors, at most QBS_UNIX_MAX_FDS.
+ *
+ * @return True if sent successfully, otherwise errors can be found in errno.
+ *
+ * @note On SOCK_STREAM the marker byte is part of the stream; the peer must call qbs_unix_recv_fds at the same point.
+ */
+QBSDEF bool qbs_unix_send_fds(qbs_unix_t *u, const int *fds, uint32_t n);
 
-QBSDEF uint64_t qbs_io_copy_buffer(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz) {
-  assert(src != 0);
-  assert(dst != 0);
-  assert(sz != 0);
+/*
+ * @brief Receives file descriptors sent with qbs_unix_send_fds.
+ *
+ * @param u   A QBS Unix object.
+ * @param fds Array receiving the descriptors (opened with O_CLOEXEC).
+ * @param n   Capacity of fds.
+ *
+ * @return the number of received descriptors
+ * @retval == 0 : if error occurred.
+ * @retval != 0 : the number of descriptors stored in fds.
+ */
+QBSDEF uint32_t qbs_unix_recv_fds(qbs_unix_t *u, int *fds, uint32_t n);
 
-  uint64_t rn, wn;
-  uint64_t ttl = 0;
+/*
+ * @brief Passes an open QBS file to the peer.
+ *
+ * @param u A QBS Unix object.
+ * @param f The file to pass; it stays usable and must still be closed by the caller.
+ *
+ * @return True if sent successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_unix_send_file(qbs_unix_t *u, qbs_file_t *f);
 
-  while (true) {
-    rn = src->read(src, buf, sz);
-    if (rn == 0 && errno == QBS_EOF)
-      break;
-    if (rn == 0)
-      return 0;
+/*
+ * @brief Receives a file sent with qbs_unix_send_file as a new QBS file object.
+ *
+ * @param u   A QBS Unix object.
+ * @param out Pointer to the qbs_file_t to be initialized; its mode is the file status flags of the sender's
+ *            descriptor, so an O_DIRECT file is streamed through an aligned buffer on this side too.
+ *
+ * @return True if received successfully, otherwise errors can be found in errno.
+ *
+ * @note Both processes share the file offset, as with dup(2).
+ */
+QBSDEF bool qbs_unix_recv_file(qbs_unix_t *u, qbs_file_t *out);
 
-    wn = dst->write(dst, buf, rn);
-    if (wn == 0)
-      return 0;
+/*
+ * @brief Creates a new QBS object for a UDP socket bound to a local address.
+ *
+ * @param out     Pointer to the qbs_udp_t to be initialized.
+ * @param address The address to bind to.
+ * @param port    The port to bind to.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note Writes are sent to the sender of the last datagram read.
+ */
+QBSDEF bool qbs_udp_bind(qbs_udp_t *out, const char *address, uint16_t port);
 
-    if (wn != rn) {
-      errno = QBS_PARTW;
-      return 0;
+/*
+ * @brief Creates a new QBS object for a UDP socket connected to a remote peer.
+ *
+ * @param out     Pointer to the qbs_udp_t to be initialized.
+ * @param address The peer address.
+ * @param port    The peer port.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_udp_dial(qbs_udp_t *out, const char *address, uint16_t port);
+
+/*
+ * @brief Receives up to n datagrams with a single recvmmsg call, blocking until at least one is available.
+ *
+ * @param u    A QBS UDP object.
+ * @param msgs Datagram slots; buffer and size must be set by the caller.
+ * @param n    Number of slots in msgs.
+ *
+ * @return the number of datagrams received
+ * @retval == 0 : if error occurred.
+ * @retval != 0 : the number of filled slots; size, addr, segment and truncated are updated.
+ *
+ * @note At most QBS_UDP_BATCH datagrams are received per call. Datagrams larger than their slot are truncated
+ *       and flagged with truncated.
+ */
+QBSDEF uint64_t qbs_udp_recv_batch(qbs_udp_t *u, qbs_udp_msg_t *msgs, uint64_t n);
+
+/*
+ * @brief Sends n datagrams using as few sendmmsg calls as possible.
+ *
+ * @param u    A QBS UDP object.
+ * @param msgs Datagram slots; a non-zero segment asks the kernel to split the buffer (UDP_SEGMENT).
+ * @param n    Number of slots in msgs.
+ *
+ * @return the number of datagrams sent
+ * @retval == 0 : if error occurred.
+ * @retval  < n : a later sendmmsg failed after the returned datagrams were sent; errors can be found in errno.
+ * @retval == n : all the datagrams were sent.
+ */
+QBSDEF uint64_t qbs_udp_send_batch(qbs_udp_t *u, qbs_udp_msg_t *msgs, uint64_t n);
+
+/*
+ * @brief Enables generic segmentation offload for every write on the socket.
+ *
+ * @param u       A QBS UDP object.
+ * @param segment Size of each datagram the kernel splits writes into; 0 disables segmentation.
+ *
+ * @return True if the option was set, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_udp_set_gso(qbs_udp_t *u, uint16_t segment);
+
+/*
+ * @brief Enables generic receive offload; consecutive datagrams from one peer may be coalesced into one read.
+ *
+ * @param u      A QBS UDP object.
+ * @param enable True to enable coalescing.
+ *
+ * @return True if the option was set, otherwise errors can be found in errno.
+ *
+ * @note Use qbs_udp_recv_batch to learn the segment size of coalesced buffers; io.read does not report it.
+ */
+QBSDEF bool qbs_udp_set_gro(qbs_udp_t *u, bool enable);
+
+/*
+ * @brief Creates a new QBS object that writes length-prefixed frames to another stream source.
+ *
+ * @param out         Pointer to the qbs_frame_writer_t to be initialized.
+ * @param w           The QBS IO object frames are written to; its writev is used when implemented.
+ * @param prefix      Length prefix encoding.
+ * @param max_frame   Maximum size of a frame payload.
+ * @param buffer      Buffer where small frames are gathered until flushed.
+ * @param size        Size of the buffer.
+ * @param flush_bytes Queued size that triggers a flush; 0 flushes only when the buffer is full.
+ * @param flush_ns    Age in nanoseconds of the oldest queued frame that triggers a flush; 0 disables it.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note Thresholds are checked when a frame is queued; drive qbs_frame_poll from the event loop to bound the
+ *       latency of the last frames of a burst, or call qbs_frame_flush once a batch is complete. io.write takes
+ *       non-empty frames only, since it returns 0 on error; queue empty frames with qbs_frame_write.
+ */
+QBSDEF bool qbs_frame_writer(qbs_frame_writer_t *out, qbs_io_t *w, qbs_frame_prefix_t prefix, uint64_t max_frame, uint8_t *buffer,
+                             uint64_t size, uint64_t flush_bytes, uint64_t flush_ns);
+
+/*
+ * @brief Queues one frame. The payload is copied, or written right away together with the queued frames if it
+ *        does not fit in the buffer, so it can be reused as soon as the call returns.
+ *
+ * @param fw A QBS frame writer object.
+ * @param b  Frame payload.
+ * @param sz Size of the payload.
+ *
+ * @return True if queued successfully, otherwise errors can be found in errno.
+ *
+ * @note Once queued the frame is kept, and true is returned, even if the flush its thresholds triggered
+ *       failed; the next qbs_frame_flush or qbs_frame_poll retries it.
+ */
+QBSDEF bool qbs_frame_write(qbs_frame_writer_t *fw, uint8_t *b, uint64_t sz);
+
+/*
+ * @brief Writes every queued frame with a single write.
+ *
+ * @param fw A QBS frame writer object.
+ *
+ * @return True if written successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_frame_flush(qbs_frame_writer_t *fw);
+
+/*
+ * @brief Flushes the queued frames if the oldest one has waited flush_ns, and tells when they will be due.
+ *
+ * @param fw   A QBS frame writer object.
+ * @param next Set to the nanoseconds until the queued frames are due, UINT64_MAX if nothing is queued or
+ *             flush_ns is 0; may be NULL.
+ *
+ * @return True if nothing was due or the flush succeeded, otherwise errors can be found in errno.
+ *
+ * @note Call it again after *next nanoseconds (e.g. as the poll timeout) to enforce flush_ns without new frames.
+ */
+QBSDEF bool qbs_frame_poll(qbs_frame_writer_t *fw, uint64_t *next);
+
+/*
+ * @brief Creates a new QBS object that reads length-prefixed frames from another stream source.
+ *
+ * @param out       Pointer to the qbs_frame_reader_t to be initialized.
+ * @param r         The QBS IO object frames are read from.
+ * @param prefix    Length prefix encoding.
+ * @param max_frame Maximum size of a frame payload.
+ * @param buffer    Buffer frames are read into; must hold at least max_frame plus 10 bytes.
+ * @param size      Size of the buffer.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note io.read copies one frame per call and skips zero-length frames.
+ */
+QBSDEF bool qbs_frame_reader(qbs_frame_reader_t *out, qbs_io_t *r, qbs_frame_prefix_t prefix, uint64_t max_frame, uint8_t *buffer,
+                             uint64_t size);
+
+/*
+ * @brief Returns the next frame without copying it.
+ *
+ * @param fr    A QBS frame reader object.
+ * @param frame Set to the frame payload, which points inside the reader buffer and is valid until the next call.
+ * @param size  Set to the size of the payload.
+ *
+ * @return True if a frame was returned, otherwise errors can be found in errno.
+ *
+ * @note errno is set to QBS_EOF if the stream ends between frames and QBS_UNXEOF if it ends inside one.
+ */
+QBSDEF bool qbs_frame_next(qbs_frame_reader_t *fr, uint8_t **frame, uint64_t *size);
+
+/*
+ * @brief Creates a memfd holding an empty shared memory ring.
+ *
+ * @param fd       Set to the memfd; it is inherited by child processes and can be passed with qbs_unix_send_fds.
+ * @param capacity Size of the ring storage, rounded up to a power of two.
+ *
+ * @return True if created successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_shm_create(int *fd, uint64_t capacity);
+
+/*
+ * @brief Creates a new QBS object for the consumer end of a shared memory ring.
+ *
+ * @param out Pointer to the qbs_shm_t to be initialized.
+ * @param fd  A memfd created by qbs_shm_create.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note Reads block until data is available; errno is set to EOF once the writer closed and the ring is drained.
+ */
+QBSDEF bool qbs_shm_reader(qbs_shm_t *out, int fd);
+
+/*
+ * @brief Creates a new QBS object for the producer end of a shared memory ring.
+ *
+ * @param out Pointer to the qbs_shm_t to be initialized.
+ * @param fd  A memfd created by qbs_shm_create.
+ *
+ * @return True if initialized successfully, otherwise errors can be found in errno.
+ *
+ * @note Writes block while the ring is full and fail with EPIPE once the reader closed.
+ */
+QBSDEF bool qbs_shm_writer(qbs_shm_t *out, int fd);
+
+/*
+ * @brief Reserves contiguous free space in the ring to be filled in place, blocking until some is available.
+ *
+ * @param w    A QBS shared memory writer.
+ * @param size Maximum number of bytes wanted; set to the number of bytes reserved (at least 1).
+ *
+ * @return Pointer to the reserved space, NULL on error (errors can be found in errno).
+ *
+ * @note The space is only visible to the reader after qbs_shm_commit.
+ */
+QBSDEF uint8_t *qbs_shm_reserve(qbs_shm_t *w, uint64_t *size);
+
+/*
+ * @brief Publishes n bytes of the space returned by the last qbs_shm_reserve.
+ *
+ * @param w A QBS shared memory writer.
+ * @param n Number of bytes written, at most the reserved size.
+ *
+ * @return True if committed successfully, otherwise errors can be found in errno.
+ */
+QBSDEF bool qbs_shm_commit(qbs_shm_t *w, uint64_t n);
+
+/*
+ * @brief Defines a copy function specialized for a concrete reader and writer pair. Calling the adapter
+ *        functions directly, instead of through qbs_io_t, lets the compiler inline them into the copy loop.
+ *
+ * @param name  Name of the generated function: uint64_t name(src_t *src, dst_t *dst, uint8_t *buf, uint64_t sz).
+ * @param src_t Type of the stream source read from.
+ * @param rfn   Read function of src_t, or an expression of src such as src->read.
+ * @param dst_t Type of the stream source written to.
+ * @param wfn   Write function of dst_t, or an expression of dst such as dst->write.
+ *
+ * @note The generated function behaves exactly like qbs_io_copy_buffer without its kernel fast paths.
+ */
+#define QBS_DEFINE_COPY(name, src_t, rfn, dst_t, wfn)                                                                                \
+  QBSDEF uint64_t name(src_t *src, dst_t *dst, uint8_t *buf, uint64_t sz) {                                                          \
+    assert(src != 0);                                                                                                                \
+    assert(dst != 0);                                                                                                                \
+    assert(sz != 0);                                                                                                                 \
+                                                                                                                                     \
+    uint64_t rn, wn;                                                                                                                 \
+    uint64_t ttl = 0;                                                                                                                \
+    while (true) {                                                                                                                   \
+      rn = rfn(src, buf, sz);                                                                                                        \
+      if (rn == 0 && errno == QBS_EOF)                                                                                               \
+        break;                                                                                                                       \
+      if (rn == 0)                                                                                                                   \
+        return 0;                                                                                                                    \
+                                                                                                                                     \
+      wn = wfn(dst, buf, rn);                                                                                                        \
+      if (wn == 0)                                                                                                                   \
+        return 0;                                                                                                                    \
+                                                                                                                                     \
+      if (wn != rn) {                                                                                                                \
+        errno = QBS_PARTW;                                                                                                           \
+        return 0;                                                                                                                    \
+      }                                                                                                                              \
+      if (UINT64_MAX - ttl < wn) {                                                                                                   \
+        errno = QBS_TOBIG;                                                                                                           \
+        return 0;                                                                                                                    \
+      }                                                                                                                              \
+      ttl += wn;                                                                                                                     \
+    }                                                                                                                                \
+    return ttl;                                                                                                                      \
+  }
+
+/*
+ * @brief Defines a copy function for a pair of concrete stream sources, checking their slots at run time.
+ *
+ * @param name  Name of the generated function; the unchecked copy loop is generated as name##_kernel.
+ * @param src_t Type of the stream source read from, holding its QBS object in an io field.
+ * @param rfn   Read function src_t is constructed with.
+ * @param dst_t Type of the stream source written to, holding its QBS object in an io field.
+ * @param wfn   Write function dst_t is constructed with.
+ *
+ * @note Objects whose io.read or io.write is not rfn or wfn (O_DIRECT files, zero-copy sockets, invalidated
+ *       slots, ...) are copied by qbs_io_copy_buffer instead, so the static type never bypasses the object's slots.
+ */
+#define QBS_DEFINE_TYPED_COPY(name, src_t, rfn, dst_t, wfn)                                                                          \
+  QBS_DEFINE_COPY(name##_kernel, src_t, rfn, dst_t, wfn)                                                                             \
+  QBSDEF uint64_t name(src_t *src, dst_t *dst, uint8_t *buf, uint64_t sz) {                                                          \
+    if (src->io.read != (qbs_io_read)rfn || dst->io.write != (qbs_io_write)wfn)                                                      \
+      return qbs_io_copy_buffer(&src->io, &dst->io, buf, sz);                                                                        \
+    return name##_kernel(src, dst, buf, sz);                                                                                         \
+  }
+
+/*
+ * @brief Defines a qbs_limit_t reader specialized for the type of the limited stream source.
+ *
+ * @param name Name of the generated function: uint64_t name(qbs_limit_t *ltx, uint8_t *buf, uint64_t sz).
+ * @param r_t  Type of the limited stream source (ltx->r).
+ * @param rfn  Read function of r_t.
+ */
+#define QBS_DEFINE_LIMIT_READ(name, r_t, rfn)                                                                                        \
+  QBSDEF uint64_t name(qbs_limit_t *ltx, uint8_t *buf, uint64_t sz) {                                                                \
+    assert(buf != 0);                                                                                                                \
+    assert(sz != 0);                                                                                                                 \
+    assert(ltx->done <= ltx->limit);                                                                                                 \
+                                                                                                                                     \
+    if (ltx->is_completed) {                                                                                                         \
+      errno = QBS_NOPROG;                                                                                                            \
+      return 0;                                                                                                                      \
+    }                                                                                                                                \
+                                                                                                                                     \
+    if (ltx->done == ltx->limit) {                                                                                                   \
+      ltx->is_completed = true;                                                                                                      \
+      errno = QBS_EOF;                                                                                                               \
+      return 0;                                                                                                                      \
+    }                                                                                                                                \
+                                                                                                                                     \
+    uint64_t rem = ltx->limit - ltx->done;                                                                                           \
+    sz = qbs_io_min(rem, sz);                                                                                                        \
+    uint64_t rn = rfn((r_t *)ltx->r, buf, sz);                                                                                       \
+    if (rn == 0 && errno == QBS_EOF) {                                                                                               \
+      ltx->is_completed = true;                                                                                                      \
+      return 0;                                                                                                                      \
+    }                                                                                                                                \
+    if (rn == 0)                                                                                                                     \
+      return 0;                                                                                                                      \
+                                                                                                                                     \
+    if (UINT64_MAX - ltx->done < rn) {                                                                                               \
+      errno = QBS_TOBIG;                                                                                                             \
+      return 0;                                                                                                                      \
+    }                                                                                                                                \
+                                                                                                                                     \
+    ltx->done += rn;                                                                                                                 \
+    return rn;                                                                                                                       \
+  }
+
+QBSDEF uint64_t qbs_copy_bytes_bytes(qbs_bytes_t *src, qbs_bytes_t *dst, uint8_t *buf, uint64_t sz);
+QBSDEF uint64_t qbs_copy_bytes_file(qbs_bytes_t *src, qbs_file_t *dst, uint8_t *buf, uint64_t sz);
+QBSDEF uint64_t qbs_copy_file_bytes(qbs_file_t *src, qbs_bytes_t *dst, uint8_t *buf, uint64_t sz);
+QBSDEF uint64_t qbs_copy_bytes_sock(qbs_bytes_t *src, qbs_sock_t *dst, uint8_t *buf, uint64_t sz);
+QBSDEF uint64_t qbs_copy_sock_bytes(qbs_sock_t *src, qbs_bytes_t *dst, uint8_t *buf, uint64_t sz);
+QBSDEF uint64_t qbs_copy_limit_bytes(qbs_limit_t *src, qbs_bytes_t *dst, uint8_t *buf, uint64_t sz);
+QBSDEF uint64_t qbs_copy_io_io(void *src, void *dst, uint8_t *buf, uint64_t sz);
+
+/*
+ * @brief Copies src to dst using buf, picking the specialized copy function from the static types of src and dst.
+ *
+ * @param src  Pointer to a concrete stream source (qbs_bytes_t *, qbs_file_t *, qbs_sock_t *, ...) or a qbs_io_t *.
+ * @param dst  Pointer to a concrete stream source or a qbs_io_t *.
+ * @param buf  Byte array used as the intermediate buffer for copying.
+ * @param sz   Size of the provided buffer (buf).
+ *
+ * @note Pairs without a specialized function go through qbs_io_copy_buffer, which also selects the specialized
+ *       functions at run time, so qbs_io_copy gets them when the concrete types are only known dynamically.
+ *       So do objects whose slots were changed after construction, such as O_DIRECT files or zero-copy sockets.
+ */
+#define qbs_copy_buffer(src, dst, buf, sz)                                                                                           \
+  _Generic((src),                                                                                                                    \
+      qbs_bytes_t *: _Generic((dst),                                                                                                 \
+          qbs_bytes_t *: qbs_copy_bytes_bytes,                                                                                       \
+          qbs_file_t *: qbs_copy_bytes_file,                                                                                         \
+          qbs_sock_t *: qbs_copy_bytes_sock,                                                                                         \
+          default: qbs_copy_io_io),                                                                                                  \
+      qbs_file_t *: _Generic((dst), qbs_bytes_t *: qbs_copy_file_bytes, default: qbs_copy_io_io),                                   \
+      qbs_sock_t *: _Generic((dst), qbs_bytes_t *: qbs_copy_sock_bytes, default: qbs_copy_io_io),                                   \
+      qbs_limit_t *: _Generic((dst), qbs_bytes_t *: qbs_copy_limit_bytes, default: qbs_copy_io_io),                                 \
+      default: qbs_copy_io_io)(src, dst, buf, sz)
+
+/*
+ * @brief Same as qbs_copy_buffer, but with an internal buffer like qbs_io_copy.
+ */
+#define qbs_copy(src, dst) qbs_copy_buffer(src, dst, (uint8_t[512]){0}, 512)
+
+#endif // !QBS_H_
+
+#ifdef QBS_IMPL
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/errqueue.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// The Linux specific calls are made through syscall(2) rather than their _GNU_SOURCE wrappers, so the
+// implementation compiles whatever system headers the translation unit included before qbs.h.
+#if !defined(O_DIRECT) && defined(__O_DIRECT)
+#define O_DIRECT __O_DIRECT
+#endif
+
+#define QBS_SYNC_WAIT_BEFORE 1 // SYNC_FILE_RANGE_WAIT_BEFORE
+#define QBS_SYNC_WRITE 2       // SYNC_FILE_RANGE_WRITE
+#define QBS_SYNC_WAIT_AFTER 4  // SYNC_FILE_RANGE_WAIT_AFTER
+
+typedef struct {
+  struct msghdr msg_hdr; // Layout of struct mmsghdr, as used by recvmmsg and sendmmsg.
+  unsigned int msg_len;
+} qbs_mmsghdr_t;
+
+#define qbs_io_min(a, b) (((a) < (b)) ? (a) : (b))
+
+QBSDEF uint64_t qbs_io_invalid_rw(void *ctx, uint8_t *bytes, uint64_t size) {
+  assert(0 && "unreachable");
+  assert(ctx == 0);
+  assert(bytes == 0);
+  assert(size == 0);
+  errno = QBS_NOMETH;
+  return 0;
+}
+
+QBSDEF uint16_t qbs_io_invalid_close(void *ctx) {
+  assert(0 && "unreachable");
+  assert(ctx == 0);
+  errno = QBS_NOMETH;
+  return 0;
+}
+
+// Writes every buffer of iov to fd, resuming after partial writes; iov is modified in the process.
+QBSDEF qbs_result_t qbs_fd_writev(int fd, struct iovec *iov, int cnt) {
+  uint64_t ttl = 0;
+  while (cnt != 0) {
+    int64_t res = writev(fd, iov, cnt);
+    if (res == -1)
+      return (qbs_result_t){.n = ttl, .err = errno};
+    ttl += res;
+
+    while (cnt != 0 && (uint64_t)res >= iov->iov_len) {
+      res -= iov->iov_len;
+      iov++;
+      cnt--;
     }
-    if (UINT64_MAX - ttl < wn) {
-      errno = QBS_TOBIG;
+    if (cnt != 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + res;
+      iov->iov_len -= res;
+    }
+  }
+  return (qbs_result_t){.n = ttl};
+}
+
+// Maps errno after a failed read or write to a result; library codes are negated, QBS_EOF becomes eof.
+QBSDEF qbs_result_t qbs_result_errno(void) {
+  if (errno == QBS_EOF)
+    return (qbs_result_t){.eof = true};
+  if (errno >= QBS_UNXEOF && errno <= QBS_NOADDR)
+    return (qbs_result_t){.err = -errno};
+  return (qbs_result_t){.err = errno};
+}
+
+// Sets errno from a failed result, for the functions returning 0 on error.
+QBSDEF void qbs_result_set_errno(qbs_result_t res) {
+  if (res.err != 0)
+    errno = res.err < 0 ? -res.err : res.err;
+  else if (res.eof)
+    errno = QBS_EOF;
+}
+
+QBSDEF qbs_result_t qbs_io_result_read(qbs_io_t *r, uint8_t *b, uint64_t sz) {
+  assert(r != 0);
+
+  if (r->read_result != 0)
+    return r->read_result(r, b, sz);
+
+  uint64_t rn = r->read(r, b, sz);
+  if (rn == 0)
+    return qbs_result_errno();
+  return (qbs_result_t){.n = rn};
+}
+
+QBSDEF qbs_result_t qbs_io_result_write(qbs_io_t *w, uint8_t *b, uint64_t sz) {
+  assert(w != 0);
+
+  if (w->write_result != 0)
+    return w->write_result(w, b, sz);
+
+  uint64_t wn = w->write(w, b, sz);
+  if (wn == 0)
+    return qbs_result_errno();
+  if (wn != sz)
+    return (qbs_result_t){.n = wn, .err = -QBS_PARTW};
+  return (qbs_result_t){.n = wn};
+}
+
+// Returns the number of bytes of a read result, setting errno the legacy way if there are none.
+QBSDEF uint64_t qbs_result_read_n(qbs_result_t res) {
+  if (res.n == 0)
+    qbs_result_set_errno(res);
+  return res.n;
+}
+
+// Returns the number of bytes of a write result, or 0 with errno set the legacy way if it failed.
+QBSDEF uint64_t qbs_result_write_n(qbs_result_t res) {
+  if (res.err != 0) {
+    qbs_result_set_errno(res);
+    return 0;
+  }
+  return res.n;
+}
+
+// Writes every buffer of iov to w, with a single gather write if w implements one.
+QBSDEF qbs_result_t qbs_io_result_write_iov(qbs_io_t *w, struct iovec *iov, int cnt) {
+  if (w->writev != 0)
+    return w->writev(w, iov, cnt);
+
+  qbs_result_t res = {0};
+  for (int i = 0; i < cnt; i++) {
+    if (iov[i].iov_len == 0)
+      continue;
+
+    qbs_result_t wr = qbs_io_result_write(w, iov[i].iov_base, iov[i].iov_len);
+    res.n += wr.n;
+    if (wr.err != 0) {
+      res.err = wr.err;
+      return res;
+    }
+  }
+  return res;
+}
+
+QBSDEF bool qbs_io_write_iov(qbs_io_t *w, struct iovec *iov, int cnt) {
+  qbs_result_t res = qbs_io_result_write_iov(w, iov, cnt);
+  if (res.err != 0) {
+    qbs_result_set_errno(res);
+    return false;
+  }
+  return true;
+}
+
+static QBS_NOINLINE qbs_result_t qbs_io_copy_fast(qbs_io_t *src, qbs_io_t *dst, bool *handled);
+
+static QBS_NOINLINE uint64_t qbs_io_copy_static(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz, bool *handled);
+
+QBS_DEFINE_COPY(qbs_io_copy_dynamic, qbs_io_t, src->read, qbs_io_t, dst->write)
+
+QBSDEF uint64_t qbs_io_copy_buffer(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz) {
+  assert(src != 0);
+  assert(dst != 0);
+  assert(sz != 0);
+
+  uint64_t ttl;
+  bool handled;
+
+  qbs_result_t res = qbs_io_copy_fast(src, dst, &handled);
+  if (handled) {
+    if (res.err != 0 || res.n == 0) {
+      qbs_result_set_errno(res);
       return 0;
     }
-    ttl += wn;
-    continue;
+    return res.n;
   }
-  return ttl;
+
+  ttl = qbs_io_copy_static(src, dst, buf, sz, &handled);
+  if (handled)
+    return ttl;
+
+  return qbs_io_copy_dynamic(src, dst, buf, sz);
 }
 
 QBSDEF uint64_t qbs_io_copy(qbs_io_t *src, qbs_io_t *dst) {
@@ -349,39 +1373,28 @@ QBSDEF uint64_t qbs_io_copy(qbs_io_t *src, qbs_io_t *dst) {
   return qbs_io_copy_buffer(src, dst, mid, sizeof(mid));
 }
 
-QBSDEF uint64_t qbs_io_limit_read(qbs_limit_t *ltx, uint8_t *buf, uint64_t sz) {
-  assert(buf != 0);
+QBS_DEFINE_LIMIT_READ(qbs_io_limit_read, qbs_io_t, ltx->r->read)
+
+QBSDEF qbs_result_t qbs_io_limit_read_result(qbs_limit_t *ltx, uint8_t *b, uint64_t sz) {
+  assert(b != 0);
   assert(sz != 0);
   assert(ltx->done <= ltx->limit);
 
-  if (ltx->is_completed) {
-    errno = QBS_NOPROG;
-    return 0;
-  }
-
   if (ltx->done == ltx->limit) {
     ltx->is_completed = true;
-    errno = QBS_EOF;
-    return 0;
-  }
-
-  uint64_t rem = ltx->limit - ltx->done;
-  sz = qbs_io_min(rem, sz);
-  uint64_t rn = ltx->r->read(ltx->r, buf, sz);
-  if (rn == 0 && errno == QBS_EOF) {
-    ltx->is_completed = true;
-    return 0;
+    return (qbs_result_t){.eof = true};
   }
-  if (rn == 0)
-    return 0;
 
-  if (UINT64_MAX - ltx->done < rn) {
-    errno = QBS_TOBIG;
-    return 0;
-  }
+  qbs_result_t res = qbs_io_result_read(ltx->r, b, qbs_io_min(sz, ltx->limit - ltx->done));
+  ltx->done += res.n;
 
-  ltx->done += rn;
-  return rn;
+  // Reaching the limit ends the stream with these bytes, no further call needed to learn it. Completion is
+  // only recorded where the legacy reader reports EOF, so a later io.read still gets EOF and not QBS_NOPROG.
+  if (ltx->done == ltx->limit)
+    res.eof = true;
+  if (res.eof && res.n == 0)
+    ltx->is_completed = true;
+  return res;
 }
 
 QBSDEF bool qbs_io_add_limit(qbs_limit_t *out, qbs_io_t *r, uint64_t limit) {
@@ -395,6 +1408,7 @@ QBSDEF bool qbs_io_add_limit(qbs_limit_t *out, qbs_io_t *r, uint64_t limit) {
               .read = (qbs_io_read)qbs_io_limit_read,
               .write = qbs_io_invalid_rw,
               .close = qbs_io_invalid_close,
+              .read_result = (qbs_io_read_result)qbs_io_limit_read_result,
           },
 
       .limit = limit,
@@ -411,281 +1425,2346 @@ QBSDEF uint64_t qbs_io_copy_n(qbs_io_t *src, qbs_io_t *dst, uint64_t n) {
   return qbs_io_copy((qbs_io_t *)&l, dst);
 }
 
-QBSDEF uint64_t qbs_io_read_at_least(qbs_io_t *r, uint8_t *b, uint64_t sz, uint64_t min) {
-  assert(r != 0);
-  assert(b != 0);
+QBSDEF qbs_result_t qbs_io_result_copy_buffer(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz) {
+  assert(src != 0);
+  assert(dst != 0);
   assert(sz != 0);
 
-  if (min > sz) {
-    errno = QBS_TOSMALL;
-    return 0;
-  }
+  bool handled;
+  qbs_result_t res = qbs_io_copy_fast(src, dst, &handled);
+  if (handled)
+    return res;
 
   uint64_t ttl = 0;
-  while (ttl < min) {
-    uint64_t rn = r->read(r, b, sz);
-    if (rn == 0 && errno == QBS_EOF)
-      break;
-    if (rn == 0)
-      return 0;
-
-    if (UINT64_MAX - ttl < rn) {
-      errno = QBS_TOBIG;
-      return 0;
+  while (true) {
+    qbs_result_t rr = qbs_io_result_read(src, buf, sz);
+    if (rr.n != 0) {
+      qbs_result_t wr = qbs_io_result_write(dst, buf, rr.n);
+      ttl += wr.n;
+      if (wr.err != 0)
+        return (qbs_result_t){.n = ttl, .err = wr.err};
     }
-    ttl += rn;
-  }
-  if (ttl < min) {
-    errno = QBS_UNXEOF;
-    return 0;
+    if (rr.err != 0 || rr.eof)
+      return (qbs_result_t){.n = ttl, .err = rr.err, .eof = rr.eof};
   }
-  return ttl;
 }
 
-QBSDEF uint64_t qbs_io_read_full(qbs_io_t *r, uint8_t *b, uint64_t sz) {
+QBSDEF qbs_result_t qbs_io_result_copy(qbs_io_t *src, qbs_io_t *dst) {
+  uint8_t mid[512] = {0};
+  return qbs_io_result_copy_buffer(src, dst, mid, sizeof(mid));
+}
+
+QBSDEF qbs_result_t qbs_io_result_copy_n(qbs_io_t *src, qbs_io_t *dst, uint64_t n) {
+  qbs_limit_t l;
+  qbs_io_add_limit(&l, src, n);
+
+  qbs_result_t res = qbs_io_result_copy((qbs_io_t *)&l, dst);
+  if (res.err == 0 && res.n != n)
+    res.err = -QBS_UNXEOF;
+  return res;
+}
+
+QBSDEF uint64_t qbs_section_read_at(qbs_section_reader_t *ctx, uint8_t *b, uint64_t sz, uint64_t off) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz != 0);
+
+  if (off >= ctx->limit) {
+    errno = QBS_EOF;
+    return 0;
+  }
+
+  sz = qbs_io_min(sz, ctx->limit - off);
+  return ctx->r->read_at(ctx->r, b, sz, ctx->base + off);
+}
+
+QBSDEF uint64_t qbs_section_read(qbs_section_reader_t *ctx, uint8_t *b, uint64_t sz) {
+  uint64_t rn = qbs_section_read_at(ctx, b, sz, ctx->offset);
+  if (rn == 0)
+    return 0;
+
+  ctx->offset += rn;
+  return rn;
+}
+
+QBSDEF qbs_result_t qbs_section_read_result(qbs_section_reader_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz != 0);
+
+  if (ctx->offset >= ctx->limit)
+    return (qbs_result_t){.eof = true};
+
+  sz = qbs_io_min(sz, ctx->limit - ctx->offset);
+  uint64_t rn = ctx->r->read_at(ctx->r, b, sz, ctx->base + ctx->offset);
+  if (rn == 0 && errno == QBS_EOF)
+    return (qbs_result_t){.eof = true};
+  if (rn == 0)
+    return (qbs_result_t){.err = errno};
+
+  ctx->offset += rn;
+  return (qbs_result_t){.n = rn, .eof = ctx->offset == ctx->limit};
+}
+
+QBSDEF bool qbs_section_reader(qbs_section_reader_t *out, qbs_io_t *r, uint64_t off, uint64_t n) {
+  assert(out != 0);
+  assert(r != 0);
+
+  if (r->read_at == 0) {
+    errno = QBS_NOMETH;
+    return false;
+  }
+  if (UINT64_MAX - off < n) {
+    errno = QBS_TOBIG;
+    return false;
+  }
+
+  *out = (qbs_section_reader_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_section_read,
+              .write = qbs_io_invalid_rw,
+              .close = qbs_io_invalid_close,
+              .read_at = (qbs_io_read_at)qbs_section_read_at,
+              .read_result = (qbs_io_read_result)qbs_section_read_result,
+          },
+      .r = r,
+      .base = off,
+      .offset = 0,
+      .limit = n,
+  };
+  return true;
+}
+
+typedef struct {
+  qbs_io_t *src;
+  qbs_io_t *dst;
+  uint64_t chunk;
+  _Atomic uint64_t next; // Offset of the next unclaimed chunk.
+  _Atomic uint64_t end;  // Offset where src ended; UINT64_MAX until a worker reaches EOF.
+  _Atomic uint64_t done; // Number of bytes copied by all workers.
+  _Atomic int err;       // First error seen by a worker, 0 otherwise.
+} qbs_io_parallel_t;
+
+QBSDEF void *qbs_io_parallel_worker(void *arg) {
+  qbs_io_parallel_t *p = arg;
+  uint8_t *buf = malloc(p->chunk);
+  if (buf == 0) {
+    int zero = 0;
+    atomic_compare_exchange_strong(&p->err, &zero, ENOMEM);
+    return 0;
+  }
+
+  while (atomic_load(&p->err) == 0) {
+    uint64_t off = atomic_fetch_add(&p->next, p->chunk);
+    if (off >= atomic_load(&p->end))
+      break;
+
+    uint64_t got = 0;
+    bool eof = false;
+    while (got < p->chunk) {
+      uint64_t rn = p->src->read_at(p->src, buf + got, p->chunk - got, off + got);
+      if (rn == 0 && errno == QBS_EOF) {
+        eof = true;
+        break;
+      }
+      if (rn == 0)
+        goto fail;
+      got += rn;
+    }
+
+    uint64_t put = 0;
+    while (put < got) {
+      uint64_t wn = p->dst->write_at(p->dst, buf + put, got - put, off + put);
+      if (wn == 0)
+        goto fail;
+      put += wn;
+    }
+    atomic_fetch_add(&p->done, got);
+
+    if (eof) {
+      uint64_t end = atomic_load(&p->end);
+      while (off + got < end && !atomic_compare_exchange_weak(&p->end, &end, off + got))
+        ;
+      break;
+    }
+  }
+  free(buf);
+  return 0;
+
+fail:;
+  int zero = 0;
+  atomic_compare_exchange_strong(&p->err, &zero, errno);
+  free(buf);
+  return 0;
+}
+
+QBSDEF uint64_t qbs_io_copy_parallel(qbs_io_t *src, qbs_io_t *dst, uint32_t nthreads, uint64_t chunk) {
+  assert(src != 0);
+  assert(dst != 0);
+  assert(nthreads != 0);
+  assert(chunk != 0);
+
+  if (src->read_at == 0 || dst->write_at == 0) {
+    errno = QBS_NOMETH;
+    return 0;
+  }
+
+  qbs_io_parallel_t p = {.src = src, .dst = dst, .chunk = chunk};
+  atomic_init(&p.next, 0);
+  atomic_init(&p.end, UINT64_MAX);
+  atomic_init(&p.done, 0);
+  atomic_init(&p.err, 0);
+
+  pthread_t tids[QBS_PARALLEL_THREADS - 1];
+  nthreads = qbs_io_min(nthreads, QBS_PARALLEL_THREADS);
+  uint32_t started = 0;
+  for (uint32_t i = 1; i < nthreads; i++) {
+    if (pthread_create(&tids[started], 0, qbs_io_parallel_worker, &p) != 0)
+      break;
+    started++;
+  }
+
+  // The calling thread takes part in the copy; missing helpers only reduce the parallelism.
+  qbs_io_parallel_worker(&p);
+  for (uint32_t i = 0; i < started; i++)
+    pthread_join(tids[i], 0);
+
+  int err = atomic_load(&p.err);
+  if (err != 0) {
+    errno = err;
+    return 0;
+  }
+
+  uint64_t ttl = atomic_load(&p.done);
+  if (ttl == 0)
+    errno = QBS_EOF;
+  return ttl;
+}
+
+QBSDEF uint64_t qbs_io_read_at_least(qbs_io_t *r, uint8_t *b, uint64_t sz, uint64_t min) {
+  assert(r != 0);
+  assert(b != 0);
+  assert(sz != 0);
+
+  if (min > sz) {
+    errno = QBS_TOSMALL;
+    return 0;
+  }
+
+  uint64_t ttl = 0;
+  while (ttl < min) {
+    uint64_t rn = r->read(r, b, sz);
+    if (rn == 0 && errno == QBS_EOF)
+      break;
+    if (rn == 0)
+      return 0;
+
+    if (UINT64_MAX - ttl < rn) {
+      errno = QBS_TOBIG;
+      return 0;
+    }
+    ttl += rn;
+  }
+  if (ttl < min) {
+    errno = QBS_UNXEOF;
+    return 0;
+  }
+  return ttl;
+}
+
+QBSDEF uint64_t qbs_io_read_full(qbs_io_t *r, uint8_t *b, uint64_t sz) {
   uint64_t result = qbs_io_read_at_least(r, b, sz, sz);
   return result;
 }
 
-QBSDEF uint16_t qbs_file_close(qbs_file_t *ctx) { return close(ctx->fd); }
+QBSDEF qbs_result_t qbs_io_result_read_full(qbs_io_t *r, uint8_t *b, uint64_t sz) {
+  assert(r != 0);
+  assert(b != 0);
+
+  qbs_result_t res = {0};
+  while (res.n < sz) {
+    qbs_result_t rr = qbs_io_result_read(r, b + res.n, sz - res.n);
+    res.n += rr.n;
+    res.eof = rr.eof;
+    if (rr.err != 0) {
+      res.err = rr.err;
+      return res;
+    }
+    if (rr.eof)
+      break;
+  }
+  if (res.n < sz)
+    res.err = -QBS_UNXEOF;
+  return res;
+}
+
+// Advances the streamed position and releases the page cache behind it, see qbs_file_behind.
+QBSDEF void qbs_file_behind_advance(qbs_file_t *ctx, uint64_t n, bool write) {
+  ctx->pos += n;
+  if (ctx->pos - ctx->mark < ctx->behind)
+    return;
+
+  if (!write) {
+    posix_fadvise(ctx->fd, ctx->mark, ctx->pos - ctx->mark, POSIX_FADV_DONTNEED);
+    ctx->mark = ctx->pos;
+    return;
+  }
+
+  syscall(SYS_sync_file_range, ctx->fd, (int64_t)ctx->mark, (int64_t)(ctx->pos - ctx->mark), QBS_SYNC_WRITE);
+  if (ctx->mark > ctx->drop) {
+    unsigned int flags = QBS_SYNC_WAIT_BEFORE | QBS_SYNC_WRITE | QBS_SYNC_WAIT_AFTER;
+    syscall(SYS_sync_file_range, ctx->fd, (int64_t)ctx->drop, (int64_t)(ctx->mark - ctx->drop), flags);
+    posix_fadvise(ctx->fd, ctx->drop, ctx->mark - ctx->drop, POSIX_FADV_DONTNEED);
+    ctx->drop = ctx->mark;
+  }
+  ctx->mark = ctx->pos;
+}
+
+// Writes the buffered O_DIRECT data. Whole blocks are written directly; the unaligned tail is kept for the next
+// call, unless final is set, in which case O_DIRECT is dropped to write it.
+QBSDEF bool qbs_file_direct_flush(qbs_file_t *ctx, bool final) {
+  uint64_t aligned = ctx->dlen & ~((uint64_t)QBS_DIRECT_ALIGN - 1);
+  uint64_t done = 0;
+
+  while (done < aligned) {
+    int64_t res = write(ctx->fd, ctx->direct + done, aligned - done);
+    if (res == -1)
+      return false;
+    done += res;
+  }
+
+  uint64_t tail = ctx->dlen - aligned;
+  ctx->dlen = 0;
+  if (tail == 0)
+    return true;
+
+  if (!final) {
+    memmove(ctx->direct, ctx->direct + aligned, tail);
+    ctx->dlen = tail;
+    return true;
+  }
+
+  int flags = fcntl(ctx->fd, F_GETFL);
+  if (flags == -1 || fcntl(ctx->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+    return false;
+
+  done = 0;
+  while (done < tail) {
+    int64_t res = write(ctx->fd, ctx->direct + aligned + done, tail - done);
+    if (res == -1)
+      return false;
+    done += res;
+  }
+  return fcntl(ctx->fd, F_SETFL, flags) == 0;
+}
+
+QBSDEF uint16_t qbs_file_close(qbs_file_t *ctx) {
+  if (ctx->direct == 0)
+    return close(ctx->fd);
+
+  bool ok = true;
+  if ((ctx->mode & O_ACCMODE) == O_WRONLY)
+    ok = qbs_file_direct_flush(ctx, true);
+  free(ctx->direct);
+  ctx->direct = 0;
+
+  int res = close(ctx->fd);
+  return ok ? res : -1;
+}
+
+QBSDEF qbs_result_t qbs_file_direct_read_result(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz > 0);
+
+  if (ctx->dpos == ctx->dlen) {
+    // A short block marks the end of file; the offset is now unaligned and must not be read directly again.
+    if (ctx->is_completed)
+      return (qbs_result_t){.eof = true};
+
+    int64_t res = read(ctx->fd, ctx->direct, QBS_DIRECT_BUFFER);
+    if (res == 0) {
+      ctx->is_completed = true;
+      return (qbs_result_t){.eof = true};
+    }
+    if (res < 0)
+      return (qbs_result_t){.err = errno};
+
+    ctx->is_completed = res < QBS_DIRECT_BUFFER;
+    ctx->dlen = res;
+    ctx->dpos = 0;
+  }
+
+  sz = qbs_io_min(sz, ctx->dlen - ctx->dpos);
+  memcpy(b, ctx->direct + ctx->dpos, sz);
+  ctx->dpos += sz;
+  return (qbs_result_t){.n = sz, .eof = ctx->is_completed && ctx->dpos == ctx->dlen};
+}
+
+QBSDEF uint64_t qbs_file_direct_read(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  return qbs_result_read_n(qbs_file_direct_read_result(ctx, b, sz));
+}
+
+QBSDEF qbs_result_t qbs_file_direct_write_result(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  uint64_t ttl = 0;
+  while (ttl < sz) {
+    uint64_t n = qbs_io_min(sz - ttl, QBS_DIRECT_BUFFER - ctx->dlen);
+    memcpy(ctx->direct + ctx->dlen, b + ttl, n);
+    ctx->dlen += n;
+    ttl += n;
+
+    // Bytes of this call still buffered when the flush fails were not written.
+    if (ctx->dlen == QBS_DIRECT_BUFFER && !qbs_file_direct_flush(ctx, false))
+      return (qbs_result_t){.n = ttl - n, .err = errno};
+  }
+  return (qbs_result_t){.n = ttl};
+}
+
+QBSDEF uint64_t qbs_file_direct_write(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(sz > 0);
+  return qbs_result_write_n(qbs_file_direct_write_result(ctx, b, sz));
+}
+
+QBSDEF uint64_t qbs_file_read(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert((ctx->mode & O_ACCMODE) == O_RDONLY || (ctx->mode & O_ACCMODE) == O_RDWR);
+  assert(sz > 0);
+
+  int64_t res = read(ctx->fd, b, sz);
+  if (res == 0) {
+    errno = QBS_EOF;
+    return 0;
+  }
+
+  if (res < 0)
+    return 0;
+
+  if (ctx->behind != 0)
+    qbs_file_behind_advance(ctx, res, false);
+  return res;
+}
+
+QBSDEF uint64_t qbs_file_write(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert((ctx->mode & O_ACCMODE) == O_WRONLY || (ctx->mode & O_ACCMODE) == O_RDWR);
+  assert(sz > 0);
+
+  int64_t res = write(ctx->fd, b, sz);
+  if (res == -1)
+    return 0;
+
+  if (ctx->behind != 0)
+    qbs_file_behind_advance(ctx, res, true);
+  return res;
+}
+
+QBSDEF uint64_t qbs_file_read_at(qbs_file_t *ctx, uint8_t *b, uint64_t sz, uint64_t off) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz > 0);
+
+  int64_t res = pread(ctx->fd, b, sz, off);
+  if (res == 0) {
+    errno = QBS_EOF;
+    return 0;
+  }
+
+  if (res < 0)
+    return 0;
+
+  return res;
+}
+
+QBSDEF uint64_t qbs_file_write_at(qbs_file_t *ctx, uint8_t *b, uint64_t sz, uint64_t off) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz > 0);
+
+  int64_t res = pwrite(ctx->fd, b, sz, off);
+  if (res == -1)
+    return 0;
+
+  return res;
+}
+
+QBSDEF qbs_result_t qbs_file_writev(qbs_file_t *ctx, struct iovec *iov, int cnt) {
+  assert(ctx != 0);
+
+  qbs_result_t res = qbs_fd_writev(ctx->fd, iov, cnt);
+  if (res.n != 0 && ctx->behind != 0)
+    qbs_file_behind_advance(ctx, res.n, true);
+  return res;
+}
+
+QBSDEF qbs_result_t qbs_file_read_result(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz > 0);
+
+  int64_t res = read(ctx->fd, b, sz);
+  if (res == 0)
+    return (qbs_result_t){.eof = true};
+  if (res < 0)
+    return (qbs_result_t){.err = errno};
+
+  if (ctx->behind != 0)
+    qbs_file_behind_advance(ctx, res, false);
+  return (qbs_result_t){.n = res, .eof = ctx->regular && (uint64_t)res < sz};
+}
+
+QBSDEF qbs_result_t qbs_file_write_result(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  qbs_result_t r = {0};
+  while (r.n < sz) {
+    int64_t res = write(ctx->fd, b + r.n, sz - r.n);
+    if (res == -1) {
+      r.err = errno;
+      break;
+    }
+    r.n += res;
+  }
+  if (ctx->behind != 0)
+    qbs_file_behind_advance(ctx, r.n, true);
+  return r;
+}
+
+QBSDEF bool qbs_file_from_fd(qbs_file_t *out, int fd, int mode) {
+  assert(out != 0);
+  assert(fd >= 0);
+
+  int acc = mode & O_ACCMODE;
+  bool r = acc == O_RDWR || acc == O_RDONLY;
+  bool w = acc == O_RDWR || acc == O_WRONLY;
+
+  if (mode & O_DIRECT) {
+    if (acc == O_RDWR) {
+      errno = EINVAL;
+      return false;
+    }
+
+    void *direct;
+    int res = posix_memalign(&direct, QBS_DIRECT_ALIGN, QBS_DIRECT_BUFFER);
+    if (res != 0) {
+      errno = res;
+      return false;
+    }
+
+    *out = (qbs_file_t){
+        .io =
+            {
+                .read = r ? (qbs_io_read)qbs_file_direct_read : qbs_io_invalid_rw,
+                .write = w ? (qbs_io_write)qbs_file_direct_write : qbs_io_invalid_rw,
+                .close = (qbs_io_close)qbs_file_close,
+                .read_result = r ? (qbs_io_read_result)qbs_file_direct_read_result : 0,
+                .write_result = w ? (qbs_io_write_result)qbs_file_direct_write_result : 0,
+            },
+        .filename = 0,
+        .mode = mode,
+        .fd = fd,
+        .direct = direct,
+    };
+    return true;
+  }
+
+  // Short reads only mean end of file on regular files; pipes and sockets return whatever is available.
+  struct stat st;
+  bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+  *out = (qbs_file_t){
+      .io =
+          {
+              .read = r ? (qbs_io_read)qbs_file_read : qbs_io_invalid_rw,
+              .write = w ? (qbs_io_write)qbs_file_write : qbs_io_invalid_rw,
+              .close = (qbs_io_close)qbs_file_close,
+              .read_at = r ? (qbs_io_read_at)qbs_file_read_at : 0,
+              .write_at = w ? (qbs_io_write_at)qbs_file_write_at : 0,
+              .writev = w ? (qbs_io_writev)qbs_file_writev : 0,
+              .read_result = r ? (qbs_io_read_result)qbs_file_read_result : 0,
+              .write_result = w ? (qbs_io_write_result)qbs_file_write_result : 0,
+          },
+      .filename = 0,
+      .mode = mode,
+      .fd = fd,
+      .regular = regular,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_file_open(qbs_file_t *out, const char *filename, int mode) {
+  int fd = open(filename, mode, 0644);
+  if (fd == -1)
+    return false;
+
+  if (!qbs_file_from_fd(out, fd, mode)) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+  out->filename = filename;
+  return true;
+}
+
+QBSDEF bool qbs_file_advise(qbs_file_t *f, uint64_t off, uint64_t len, int advice) {
+  assert(f != 0);
+
+  int res = posix_fadvise(f->fd, off, len, advice);
+  if (res != 0) {
+    errno = res;
+    return false;
+  }
+  return true;
+}
+
+QBSDEF bool qbs_file_behind(qbs_file_t *f, uint64_t window) {
+  assert(f != 0);
+
+  off_t pos = lseek(f->fd, 0, SEEK_CUR);
+  if (pos == -1)
+    return false;
+
+  f->behind = window;
+  f->pos = pos;
+  f->mark = pos;
+  f->drop = pos;
+  return true;
+}
+
+QBSDEF bool qbs_net_addr(struct sockaddr_storage *out, socklen_t *len, const char *address, uint16_t port) {
+  struct sockaddr_in *in4 = (struct sockaddr_in *)out;
+  struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)out;
+
+  memset(out, 0, sizeof(*out));
+  if (inet_pton(AF_INET, address, &in4->sin_addr) == 1) {
+    in4->sin_family = AF_INET;
+    in4->sin_port = htons(port);
+    *len = sizeof(*in4);
+    return true;
+  }
+  if (inet_pton(AF_INET6, address, &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons(port);
+    *len = sizeof(*in6);
+    return true;
+  }
+  errno = EINVAL;
+  return false;
+}
+
+typedef struct {
+  char host[NI_MAXHOST]; // Cached host name, empty if the slot is free.
+  uint64_t expires;      // CLOCK_MONOTONIC second the entry expires at.
+  uint32_t count;        // Number of cached addresses.
+  qbs_addr_t addrs[QBS_RESOLVER_ADDRS];
+} qbs_resolver_entry_t;
+
+static qbs_resolver_entry_t qbs_resolver_cache[QBS_RESOLVER_SLOTS];
+static pthread_mutex_t qbs_resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+
+QBSDEF uint64_t qbs_resolver_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+QBSDEF qbs_resolver_entry_t *qbs_resolver_slot(const char *host) {
+  uint32_t h = 2166136261u;
+  for (const char *c = host; *c != '\0'; c++)
+    h = (h ^ (uint8_t)*c) * 16777619u;
+  return &qbs_resolver_cache[h % QBS_RESOLVER_SLOTS];
+}
+
+QBSDEF void qbs_addr_set_port(qbs_addr_t *a, uint16_t port) {
+  if (a->addr.ss_family == AF_INET6)
+    ((struct sockaddr_in6 *)&a->addr)->sin6_port = htons(port);
+  else
+    ((struct sockaddr_in *)&a->addr)->sin_port = htons(port);
+}
+
+QBSDEF uint32_t qbs_resolve(const char *host, uint16_t port, int socktype, qbs_addr_t *out, uint32_t n) {
+  assert(out != 0);
+  assert(n != 0);
+
+  bool wildcard = host == 0 || host[0] == '\0';
+  if (!wildcard && qbs_net_addr(&out->addr, &out->addrlen, host, port))
+    return 1;
+
+  bool cacheable = !wildcard && strlen(host) < NI_MAXHOST;
+  if (cacheable) {
+    qbs_resolver_entry_t *e = qbs_resolver_slot(host);
+    uint32_t cnt = 0;
+
+    pthread_mutex_lock(&qbs_resolver_lock);
+    if (e->count != 0 && strcmp(e->host, host) == 0 && e->expires > qbs_resolver_now()) {
+      cnt = qbs_io_min(n, e->count);
+      memcpy(out, e->addrs, sizeof(*out) * cnt);
+    }
+    pthread_mutex_unlock(&qbs_resolver_lock);
+
+    if (cnt != 0) {
+      for (uint32_t i = 0; i < cnt; i++)
+        qbs_addr_set_port(&out[i], port);
+      return cnt;
+    }
+  }
+
+  struct addrinfo hints = {
+      .ai_family = AF_UNSPEC,
+      .ai_socktype = socktype,
+      .ai_flags = wildcard ? AI_PASSIVE : 0,
+  };
+  struct addrinfo *res, *ai;
+  int rc = getaddrinfo(wildcard ? 0 : host, 0, &hints, &res);
+  if (rc != 0) {
+    if (rc != EAI_SYSTEM)
+      errno = QBS_NOADDR;
+    return 0;
+  }
+
+  // The lookup runs without the lock, so concurrent misses on one host may resolve it more than once.
+  qbs_addr_t addrs[QBS_RESOLVER_ADDRS];
+  uint32_t cnt = 0;
+  for (ai = res; ai != 0 && cnt < QBS_RESOLVER_ADDRS; ai = ai->ai_next) {
+    if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) || ai->ai_addrlen > sizeof(addrs[cnt].addr))
+      continue;
+    memset(&addrs[cnt], 0, sizeof(addrs[cnt]));
+    memcpy(&addrs[cnt].addr, ai->ai_addr, ai->ai_addrlen);
+    addrs[cnt].addrlen = ai->ai_addrlen;
+    cnt++;
+  }
+  freeaddrinfo(res);
+
+  if (cnt == 0) {
+    errno = QBS_NOADDR;
+    return 0;
+  }
+
+  if (cacheable) {
+    qbs_resolver_entry_t *e = qbs_resolver_slot(host);
+
+    pthread_mutex_lock(&qbs_resolver_lock);
+    strcpy(e->host, host);
+    e->expires = qbs_resolver_now() + QBS_RESOLVER_TTL;
+    e->count = cnt;
+    memcpy(e->addrs, addrs, sizeof(addrs[0]) * cnt);
+    pthread_mutex_unlock(&qbs_resolver_lock);
+  }
+
+  cnt = qbs_io_min(n, cnt);
+  for (uint32_t i = 0; i < cnt; i++) {
+    out[i] = addrs[i];
+    qbs_addr_set_port(&out[i], port);
+  }
+  return cnt;
+}
+
+QBSDEF void qbs_resolve_flush(void) {
+  pthread_mutex_lock(&qbs_resolver_lock);
+  for (uint32_t i = 0; i < QBS_RESOLVER_SLOTS; i++)
+    qbs_resolver_cache[i].count = 0;
+  pthread_mutex_unlock(&qbs_resolver_lock);
+}
+
+// Connects to the first reachable address, racing attempts as described in qbs_tcp_dial; returns the socket or -1.
+QBSDEF int qbs_tcp_connect(qbs_addr_t *addrs, uint32_t n) {
+  // Alternate address families so a broken IPv6 or IPv4 path only costs one stagger delay.
+  qbs_addr_t order[QBS_RESOLVER_ADDRS];
+  uint32_t cnt = 0;
+  bool taken[QBS_RESOLVER_ADDRS] = {false};
+  int family = addrs[0].addr.ss_family;
+  while (cnt < n) {
+    uint32_t i;
+    for (i = 0; i < n && (taken[i] || addrs[i].addr.ss_family != family); i++)
+      ;
+    if (i == n)
+      for (i = 0; taken[i]; i++)
+        ;
+    taken[i] = true;
+    order[cnt++] = addrs[i];
+    family = family == AF_INET6 ? AF_INET : AF_INET6;
+  }
+
+  struct pollfd pfds[QBS_RESOLVER_ADDRS];
+  uint32_t live = 0, next = 0;
+  int sock = -1, err = ECONNREFUSED;
+
+  while (sock == -1) {
+    // Start the next attempt when the stagger delay expired or every running attempt failed.
+    while (next < n) {
+      int fd = socket(order[next].addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      int res = fd == -1 ? -1 : connect(fd, (struct sockaddr *)&order[next].addr, order[next].addrlen);
+      next++;
+
+      if (res == 0) {
+        sock = fd;
+        break;
+      }
+      if (res == -1 && errno == EINPROGRESS) {
+        pfds[live++] = (struct pollfd){.fd = fd, .events = POLLOUT};
+        break;
+      }
+      err = errno;
+      if (fd != -1)
+        close(fd);
+    }
+    if (sock != -1)
+      break;
+    if (live == 0) {
+      errno = err;
+      return -1;
+    }
+
+    int ready = poll(pfds, live, next < n ? QBS_DIAL_STAGGER : -1);
+    if (ready == -1 && errno != EINTR) {
+      err = errno;
+      break;
+    }
+
+    for (uint32_t i = 0; ready > 0 && i < live; i++) {
+      if (pfds[i].revents == 0)
+        continue;
+
+      int soerr = 0;
+      socklen_t len = sizeof(soerr);
+      if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len) == 0 && soerr == 0) {
+        sock = pfds[i].fd;
+        pfds[i] = pfds[--live];
+        break;
+      }
+      err = soerr != 0 ? soerr : errno;
+      close(pfds[i].fd);
+      pfds[i--] = pfds[--live];
+    }
+  }
+
+  for (uint32_t i = 0; i < live; i++)
+    close(pfds[i].fd);
+  if (sock == -1) {
+    errno = err;
+    return -1;
+  }
+
+  int flags = fcntl(sock, F_GETFL);
+  if (flags == -1 || fcntl(sock, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+QBSDEF bool qbs_tcp_zerocopy_reap(qbs_sock_t *s, bool wait);
+
+QBSDEF void qbs_tcp_zerocopy_release(qbs_zc_t *zc);
+
+QBSDEF uint16_t qbs_tcp_close(qbs_sock_t *ctx) {
+  if (ctx->zc != 0) {
+    // Buffers must not be released while the kernel may still read them. If the connection broke the
+    // kernel drops its send queue, so what is left is released as is.
+    qbs_tcp_zerocopy_reap(ctx, true);
+    for (uint32_t i = 0; i < ctx->zc->count; i++)
+      ctx->zc->pending[(ctx->zc->head + i) % QBS_ZEROCOPY_PENDING].left = 0;
+    qbs_tcp_zerocopy_release(ctx->zc);
+    free(ctx->zc);
+    ctx->zc = 0;
+  }
+  return close(ctx->sock);
+}
+
+QBSDEF uint64_t qbs_tcp_read(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  int64_t res = read(ctx->sock, b, sz);
+  if (res == 0) {
+    errno = QBS_EOF;
+    return 0;
+  }
+  if (res == -1)
+    return 0;
+  return res;
+}
+
+QBSDEF uint64_t qbs_tcp_write(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  uint64_t ttl = sz;
+  while (sz != 0) {
+    int64_t res = write(ctx->sock, b, sz);
+    if (res == -1)
+      return 0;
+    sz -= res;
+    b += res;
+  }
+  return ttl;
+}
+
+QBSDEF qbs_result_t qbs_tcp_writev(qbs_sock_t *ctx, struct iovec *iov, int cnt) {
+  assert(ctx != 0);
+  return qbs_fd_writev(ctx->sock, iov, cnt);
+}
+
+QBSDEF qbs_result_t qbs_tcp_read_result(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  int64_t res = read(ctx->sock, b, sz);
+  if (res == 0)
+    return (qbs_result_t){.eof = true};
+  if (res == -1)
+    return (qbs_result_t){.err = errno};
+  return (qbs_result_t){.n = res};
+}
+
+QBSDEF qbs_result_t qbs_tcp_write_result(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  qbs_result_t r = {0};
+  while (r.n < sz) {
+    int64_t res = write(ctx->sock, b + r.n, sz - r.n);
+    if (res == -1) {
+      r.err = errno;
+      break;
+    }
+    r.n += res;
+  }
+  return r;
+}
+
+// Applies the completion of notification ids [lo, hi] to the pending buffers.
+QBSDEF void qbs_tcp_zerocopy_complete(qbs_zc_t *zc, uint32_t lo, uint32_t hi, bool copied) {
+  for (uint32_t i = 0; i < zc->count; i++) {
+    qbs_zc_pending_t *p = &zc->pending[(zc->head + i) % QBS_ZEROCOPY_PENDING];
+
+    // Ids wrap around at 2^32, so the range is taken relative to the buffer's first id.
+    int64_t from = (int32_t)(lo - p->first);
+    int64_t to = (int32_t)(hi - p->first);
+    from = from < 0 ? 0 : from;
+    to = to >= p->sends ? (int64_t)p->sends - 1 : to;
+    if (from > to)
+      continue;
+
+    p->left -= to - from + 1;
+    p->copied |= copied;
+  }
+}
+
+// Releases the buffers whose sends all completed, in send order so callers can recycle them as a ring.
+QBSDEF void qbs_tcp_zerocopy_release(qbs_zc_t *zc) {
+  while (zc->count != 0 && zc->pending[zc->head].left == 0) {
+    qbs_zc_pending_t *p = &zc->pending[zc->head];
+    if (p->copied)
+      zc->copied += p->size;
+    else
+      zc->zerocopied += p->size;
+    if (p->release != 0)
+      p->release(p->arg, p->buf, p->size, p->copied);
+    zc->head = (zc->head + 1) % QBS_ZEROCOPY_PENDING;
+    zc->count--;
+  }
+}
+
+// Reaps completions until at most target buffers are pending, or until the error queue is empty if !wait.
+QBSDEF bool qbs_tcp_zerocopy_wait(qbs_sock_t *s, uint32_t target, bool wait) {
+  qbs_zc_t *zc = s->zc;
+  bool hangup = false;
+  while (zc->count > target) {
+    uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+
+    if (recvmsg(s->sock, &msg, MSG_ERRQUEUE) == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN || !wait)
+        return errno == EAGAIN;
+
+      // POLLERR with an empty error queue is a socket error, and nothing more will complete after a hangup.
+      if (hangup) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(s->sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        errno = err != 0 ? err : EPIPE;
+        return false;
+      }
+
+      // The error queue raises POLLERR once a notification is queued.
+      struct pollfd pfd = {.fd = s->sock};
+      if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        return false;
+      hangup = pfd.revents & (POLLERR | POLLHUP);
+      continue;
+    }
+    hangup = false;
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != 0; c = CMSG_NXTHDR(&msg, c)) {
+      if (!(c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) &&
+          !(c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))
+        continue;
+
+      struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(c);
+      if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        errno = ee->ee_errno;
+        return false;
+      }
+      qbs_tcp_zerocopy_complete(zc, ee->ee_info, ee->ee_data, ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+    }
+    qbs_tcp_zerocopy_release(zc);
+  }
+  return true;
+}
+
+QBSDEF bool qbs_tcp_zerocopy_reap(qbs_sock_t *s, bool wait) {
+  assert(s != 0);
+  assert(s->zc != 0);
+  return qbs_tcp_zerocopy_wait(s, 0, wait);
+}
+
+// Drops the guard of the buffer being sent after a failed send. The buffer is forgotten if none of its sends
+// went out, since the caller keeps it on failure, otherwise it is released once those sends complete.
+QBSDEF bool qbs_tcp_write_zc_fail(qbs_zc_t *zc, qbs_zc_pending_t *p) {
+  int err = errno;
+  p->left--;
+  if (p->sends == 0)
+    zc->count--;
+  else
+    qbs_tcp_zerocopy_release(zc);
+  errno = err;
+  return false;
+}
+
+QBSDEF bool qbs_tcp_write_zc(qbs_sock_t *s, const uint8_t *b, uint64_t sz, qbs_zc_release release, void *arg) {
+  assert(s != 0);
+  assert(s->zc != 0);
+  assert(b != 0);
+
+  qbs_zc_t *zc = s->zc;
+  if (sz < zc->threshold) {
+    if (sz != 0 && qbs_tcp_write(s, (uint8_t *)b, sz) != sz)
+      return false;
+    zc->copied += sz;
+    if (release != 0)
+      release(arg, b, sz, true);
+    return true;
+  }
+
+  if (zc->count == QBS_ZEROCOPY_PENDING && !qbs_tcp_zerocopy_wait(s, QBS_ZEROCOPY_PENDING - 1, true))
+    return false;
+
+  // left starts at one so reaping while sending cannot release the buffer before all of it is queued.
+  qbs_zc_pending_t *p = &zc->pending[(zc->head + zc->count) % QBS_ZEROCOPY_PENDING];
+  *p = (qbs_zc_pending_t){.release = release, .arg = arg, .buf = b, .size = sz, .first = zc->next, .left = 1};
+  zc->count++;
+
+  uint64_t off = 0;
+  while (off < sz) {
+    int64_t res = send(s->sock, b + off, sz - off, MSG_ZEROCOPY);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != ENOBUFS)
+        return qbs_tcp_write_zc_fail(zc, p);
+
+      // Out of lockable memory: wait for earlier sends to unpin their pages, or copy if nothing is in flight.
+      if (p->left > 1 || zc->count > 1) {
+        if (!qbs_tcp_zerocopy_reap(s, false))
+          return qbs_tcp_write_zc_fail(zc, p);
+        struct pollfd pfd = {.fd = s->sock};
+        poll(&pfd, 1, 1);
+        continue;
+      }
+      if (qbs_tcp_write(s, (uint8_t *)b + off, sz - off) != sz - off)
+        return qbs_tcp_write_zc_fail(zc, p);
+      p->copied = true;
+      break;
+    }
+    off += res;
+    zc->next++;
+    p->sends++;
+    p->left++;
+  }
+
+  p->left--;
+  qbs_tcp_zerocopy_release(zc);
+  return qbs_tcp_zerocopy_reap(s, false);
+}
+
+QBSDEF qbs_result_t qbs_tcp_write_zc_sync_result(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
+  if (!qbs_tcp_write_zc(ctx, b, sz, 0, 0))
+    return (qbs_result_t){.err = errno};
+  if (!qbs_tcp_zerocopy_reap(ctx, true))
+    return (qbs_result_t){.n = sz, .err = errno};
+  return (qbs_result_t){.n = sz};
+}
+
+QBSDEF uint64_t qbs_tcp_write_zc_sync(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
+  return qbs_result_write_n(qbs_tcp_write_zc_sync_result(ctx, b, sz));
+}
+
+QBSDEF bool qbs_tcp_zerocopy(qbs_sock_t *s, uint64_t threshold) {
+  assert(s != 0);
+
+  int opt = 1;
+  if (setsockopt(s->sock, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) != 0)
+    return false;
+
+  if (s->zc == 0) {
+    s->zc = calloc(1, sizeof(qbs_zc_t));
+    if (s->zc == 0)
+      return false;
+  }
+  s->zc->threshold = threshold;
+  s->io.write = (qbs_io_write)qbs_tcp_write_zc_sync;
+  s->io.write_result = (qbs_io_write_result)qbs_tcp_write_zc_sync_result;
+  return true;
+}
+
+QBSDEF bool qbs_tcp_dial(qbs_sock_t *out, const char *address, uint16_t port) {
+  qbs_addr_t addrs[QBS_RESOLVER_ADDRS];
+  uint32_t n = qbs_resolve(address, port, SOCK_STREAM, addrs, QBS_RESOLVER_ADDRS);
+  if (n == 0)
+    return false;
+
+  int sock = qbs_tcp_connect(addrs, n);
+  if (sock == -1)
+    return false;
+
+  *out = (qbs_sock_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_tcp_read,
+              .write = (qbs_io_write)qbs_tcp_write,
+              .close = (qbs_io_close)qbs_tcp_close,
+              .writev = (qbs_io_writev)qbs_tcp_writev,
+              .read_result = (qbs_io_read_result)qbs_tcp_read_result,
+              .write_result = (qbs_io_write_result)qbs_tcp_write_result,
+          },
+      .address = address,
+      .port = port,
+      .sock = sock,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_tcp_listen(qbs_listener_t *out, const char *address, uint16_t port) {
+  qbs_addr_t addrs[QBS_RESOLVER_ADDRS];
+  uint32_t n = qbs_resolve(address, port, SOCK_STREAM, addrs, QBS_RESOLVER_ADDRS);
+  if (n == 0)
+    return false;
+
+  // Bind to the first address that works, IPv4 first: a listener has one socket, and clients given a host name
+  // race both families while clients given 127.0.0.1 only reach IPv4.
+  qbs_addr_t sorted[QBS_RESOLVER_ADDRS];
+  uint32_t m = 0;
+  for (uint32_t i = 0; i < n; i++)
+    if (addrs[i].addr.ss_family == AF_INET)
+      sorted[m++] = addrs[i];
+  for (uint32_t i = 0; i < n; i++)
+    if (addrs[i].addr.ss_family != AF_INET)
+      sorted[m++] = addrs[i];
+  memcpy(addrs, sorted, n * sizeof(qbs_addr_t));
+
+  for (uint32_t i = 0; i < n; i++) {
+    int sock, res;
+    int opt = 1;
+
+    sock = socket(addrs[i].addr.ss_family, SOCK_STREAM, 0);
+    if (sock == -1)
+      continue;
+
+    res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (res == 0)
+      res = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    if (res == 0)
+      res = bind(sock, (struct sockaddr *)&addrs[i].addr, addrs[i].addrlen);
+    if (res == 0)
+      res = listen(sock, 4);
+    if (res != 0) {
+      int err = errno;
+      close(sock);
+      errno = err;
+      continue;
+    }
+
+    *out = (qbs_listener_t){
+        .sock = sock,
+        .address = addrs[i].addr,
+        .addrlen = addrs[i].addrlen,
+    };
+    return true;
+  }
+  return false;
+}
+
+QBSDEF bool qbs_tcp_accept(qbs_sock_t *out, qbs_listener_t *l) {
+  int sock = accept(l->sock, 0, 0);
+  if (sock == -1) {
+    return false;
+  }
+
+  *out = (qbs_sock_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_tcp_read,
+              .write = (qbs_io_write)qbs_tcp_write,
+              .close = (qbs_io_close)qbs_tcp_close,
+              .writev = (qbs_io_writev)qbs_tcp_writev,
+              .read_result = (qbs_io_read_result)qbs_tcp_read_result,
+              .write_result = (qbs_io_write_result)qbs_tcp_write_result,
+          },
+      .sock = sock,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_unix_addr(struct sockaddr_un *out, socklen_t *len, const char *path) {
+  bool abstract = path[0] == '@';
+  size_t n = strlen(path);
+
+  // Filesystem paths need room for the NUL terminator, abstract names replace '@' with a leading NUL.
+  if (n >= sizeof(out->sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  memset(out, 0, sizeof(*out));
+  out->sun_family = AF_UNIX;
+  memcpy(out->sun_path, path, n);
+  if (abstract) {
+    out->sun_path[0] = '\0';
+    *len = offsetof(struct sockaddr_un, sun_path) + n;
+  } else {
+    *len = offsetof(struct sockaddr_un, sun_path) + n + 1;
+  }
+  return true;
+}
+
+QBSDEF uint16_t qbs_unix_close(qbs_unix_t *ctx) { return close(ctx->sock); }
+
+QBSDEF qbs_result_t qbs_unix_read_result(qbs_unix_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  // recvmsg reports records cut short by the buffer, which read would return as if they were complete.
+  struct iovec iov = {.iov_base = b, .iov_len = sz};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  int64_t res = recvmsg(ctx->sock, &msg, 0);
+  if (res == 0)
+    return (qbs_result_t){.eof = true};
+  if (res == -1)
+    return (qbs_result_t){.err = errno};
+  if (msg.msg_flags & MSG_TRUNC)
+    return (qbs_result_t){.err = -QBS_TOSMALL};
+  return (qbs_result_t){.n = res};
+}
+
+QBSDEF uint64_t qbs_unix_read(qbs_unix_t *ctx, uint8_t *b, uint64_t sz) { return qbs_result_read_n(qbs_unix_read_result(ctx, b, sz)); }
+
+QBSDEF qbs_result_t qbs_unix_write_result(qbs_unix_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  if (ctx->type == SOCK_SEQPACKET) {
+    int64_t res = write(ctx->sock, b, sz);
+    if (res == -1)
+      return (qbs_result_t){.err = errno};
+    return (qbs_result_t){.n = res};
+  }
+
+  qbs_result_t r = {0};
+  while (r.n < sz) {
+    int64_t res = write(ctx->sock, b + r.n, sz - r.n);
+    if (res == -1) {
+      r.err = errno;
+      break;
+    }
+    r.n += res;
+  }
+  return r;
+}
+
+QBSDEF uint64_t qbs_unix_write(qbs_unix_t *ctx, uint8_t *b, uint64_t sz) {
+  return qbs_result_write_n(qbs_unix_write_result(ctx, b, sz));
+}
+
+QBSDEF qbs_result_t qbs_unix_writev(qbs_unix_t *ctx, struct iovec *iov, int cnt) {
+  assert(ctx != 0);
+
+  if (ctx->type == SOCK_SEQPACKET) {
+    int64_t res = writev(ctx->sock, iov, cnt);
+    if (res == -1)
+      return (qbs_result_t){.err = errno};
+    return (qbs_result_t){.n = res};
+  }
+  return qbs_fd_writev(ctx->sock, iov, cnt);
+}
+
+QBSDEF bool qbs_unix_dial(qbs_unix_t *out, const char *path, int type) {
+  assert(type == SOCK_STREAM || type == SOCK_SEQPACKET);
+
+  struct sockaddr_un addr;
+  socklen_t addrlen;
+  if (!qbs_unix_addr(&addr, &addrlen, path))
+    return false;
+
+  int sock = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+  if (sock == -1)
+    return false;
+
+  if (connect(sock, (struct sockaddr *)&addr, addrlen) != 0) {
+    close(sock);
+    return false;
+  }
+
+  *out = (qbs_unix_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_unix_read,
+              .write = (qbs_io_write)qbs_unix_write,
+              .read_result = (qbs_io_read_result)qbs_unix_read_result,
+              .write_result = (qbs_io_write_result)qbs_unix_write_result,
+              .close = (qbs_io_close)qbs_unix_close,
+              .writev = (qbs_io_writev)qbs_unix_writev,
+          },
+      .path = path,
+      .type = type,
+      .sock = sock,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_unix_listen(qbs_unix_listener_t *out, const char *path, int type) {
+  assert(type == SOCK_STREAM || type == SOCK_SEQPACKET);
+
+  struct sockaddr_un addr;
+  socklen_t addrlen;
+  if (!qbs_unix_addr(&addr, &addrlen, path))
+    return false;
+
+  int sock = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+  if (sock == -1)
+    return false;
+
+  int res = bind(sock, (struct sockaddr *)&addr, addrlen);
+  if (res != 0) {
+    close(sock);
+    return false;
+  }
+  res = listen(sock, 4);
+  if (res != 0) {
+    close(sock);
+    return false;
+  }
+
+  *out = (qbs_unix_listener_t){
+      .sock = sock,
+      .type = type,
+      .address = addr,
+      .addrlen = addrlen,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_unix_accept(qbs_unix_t *out, qbs_unix_listener_t *l) {
+  int sock = syscall(SYS_accept4, l->sock, 0, 0, SOCK_CLOEXEC);
+  if (sock == -1)
+    return false;
+
+  *out = (qbs_unix_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_unix_read,
+              .write = (qbs_io_write)qbs_unix_write,
+              .read_result = (qbs_io_read_result)qbs_unix_read_result,
+              .write_result = (qbs_io_write_result)qbs_unix_write_result,
+              .close = (qbs_io_close)qbs_unix_close,
+              .writev = (qbs_io_writev)qbs_unix_writev,
+          },
+      .type = l->type,
+      .sock = sock,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_unix_send_fds(qbs_unix_t *u, const int *fds, uint32_t n) {
+  assert(u != 0);
+  assert(fds != 0);
+
+  if (n == 0 || n > QBS_UNIX_MAX_FDS) {
+    errno = QBS_TOBIG;
+    return false;
+  }
+
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * QBS_UNIX_MAX_FDS)];
+    struct cmsghdr align;
+  } ctl;
+  uint8_t marker = 'F';
+  struct iovec iov = {.iov_base = &marker, .iov_len = 1};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctl.buf,
+      .msg_controllen = CMSG_SPACE(sizeof(int) * n),
+  };
+
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int) * n);
+  memcpy(CMSG_DATA(c), fds, sizeof(int) * n);
+
+  return sendmsg(u->sock, &msg, 0) == 1;
+}
+
+QBSDEF uint32_t qbs_unix_recv_fds(qbs_unix_t *u, int *fds, uint32_t n) {
+  assert(u != 0);
+  assert(fds != 0);
+  assert(n != 0);
+
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * QBS_UNIX_MAX_FDS)];
+    struct cmsghdr align;
+  } ctl;
+  uint8_t marker;
+  struct iovec iov = {.iov_base = &marker, .iov_len = 1};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctl.buf,
+      .msg_controllen = sizeof(ctl.buf),
+  };
+
+  int64_t res = recvmsg(u->sock, &msg, MSG_CMSG_CLOEXEC);
+  if (res == 0) {
+    errno = QBS_EOF;
+    return 0;
+  }
+  if (res == -1)
+    return 0;
+
+  uint32_t cnt = 0;
+  bool overflow = (msg.msg_flags & MSG_CTRUNC) != 0;
+  struct cmsghdr *c;
+  for (c = CMSG_FIRSTHDR(&msg); c != 0; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    uint32_t got = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (uint32_t i = 0; i < got; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+      if (cnt < n)
+        fds[cnt++] = fd;
+      else {
+        overflow = true;
+        close(fd);
+      }
+    }
+  }
+
+  if (overflow) {
+    for (uint32_t i = 0; i < cnt; i++)
+      close(fds[i]);
+    errno = QBS_TOSMALL;
+    return 0;
+  }
+  if (cnt == 0) {
+    errno = QBS_NOPROG;
+    return 0;
+  }
+  return cnt;
+}
+
+QBSDEF bool qbs_unix_send_file(qbs_unix_t *u, qbs_file_t *f) {
+  assert(f != 0);
+  return qbs_unix_send_fds(u, &f->fd, 1);
+}
+
+QBSDEF bool qbs_unix_recv_file(qbs_unix_t *u, qbs_file_t *out) {
+  assert(out != 0);
+
+  int fd = -1;
+  if (qbs_unix_recv_fds(u, &fd, 1) == 0)
+    return false;
+
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1) {
+    close(fd);
+    return false;
+  }
+  if (!qbs_file_from_fd(out, fd, flags)) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+  return true;
+}
+
+QBSDEF uint16_t qbs_udp_close(qbs_udp_t *ctx) { return close(ctx->sock); }
+
+QBSDEF qbs_result_t qbs_udp_read_result(qbs_udp_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  int64_t res;
+  do {
+    // Zero-length datagrams carry nothing a reader can return, skip them.
+    ctx->peerlen = sizeof(ctx->peer);
+    res = recvfrom(ctx->sock, b, sz, MSG_TRUNC, (struct sockaddr *)&ctx->peer, &ctx->peerlen);
+  } while (res == 0);
+
+  if (res == -1)
+    return (qbs_result_t){.err = errno};
+
+  // MSG_TRUNC returns the full length; passing on part of a datagram would corrupt message based streams.
+  if ((uint64_t)res > sz)
+    return (qbs_result_t){.err = -QBS_TOSMALL};
+  return (qbs_result_t){.n = res};
+}
+
+QBSDEF uint64_t qbs_udp_read(qbs_udp_t *ctx, uint8_t *b, uint64_t sz) { return qbs_result_read_n(qbs_udp_read_result(ctx, b, sz)); }
+
+QBSDEF qbs_result_t qbs_udp_write_result(qbs_udp_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  int64_t res;
+  if (ctx->is_connected) {
+    res = send(ctx->sock, b, sz, 0);
+  } else {
+    if (ctx->peerlen == 0)
+      return (qbs_result_t){.err = EDESTADDRREQ};
+    res = sendto(ctx->sock, b, sz, 0, (struct sockaddr *)&ctx->peer, ctx->peerlen);
+  }
+  if (res == -1)
+    return (qbs_result_t){.err = errno};
+  return (qbs_result_t){.n = res};
+}
+
+QBSDEF uint64_t qbs_udp_write(qbs_udp_t *ctx, uint8_t *b, uint64_t sz) { return qbs_result_write_n(qbs_udp_write_result(ctx, b, sz)); }
+
+QBSDEF bool qbs_udp_open(qbs_udp_t *out, const char *address, uint16_t port, bool dial) {
+  qbs_addr_t addr;
+
+  if (qbs_resolve(address, port, SOCK_DGRAM, &addr, 1) == 0)
+    return false;
+
+  int sock = socket(addr.addr.ss_family, SOCK_DGRAM, 0);
+  if (sock == -1)
+    return false;
+
+  struct sockaddr *sa = (struct sockaddr *)&addr.addr;
+  int res = dial ? connect(sock, sa, addr.addrlen) : bind(sock, sa, addr.addrlen);
+  if (res != 0) {
+    close(sock);
+    return false;
+  }
+
+  *out = (qbs_udp_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_udp_read,
+              .write = (qbs_io_write)qbs_udp_write,
+              .close = (qbs_io_close)qbs_udp_close,
+              .read_result = (qbs_io_read_result)qbs_udp_read_result,
+              .write_result = (qbs_io_write_result)qbs_udp_write_result,
+          },
+      .address = address,
+      .port = port,
+      .sock = sock,
+      .is_connected = dial,
+      .peerlen = 0,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_udp_bind(qbs_udp_t *out, const char *address, uint16_t port) { return qbs_udp_open(out, address, port, false); }
+
+QBSDEF bool qbs_udp_dial(qbs_udp_t *out, const char *address, uint16_t port) { return qbs_udp_open(out, address, port, true); }
+
+QBSDEF uint64_t qbs_udp_recv_batch(qbs_udp_t *u, qbs_udp_msg_t *msgs, uint64_t n) {
+  assert(u != 0);
+  assert(msgs != 0);
+  assert(n != 0);
+
+  qbs_mmsghdr_t hdrs[QBS_UDP_BATCH];
+  struct iovec iovs[QBS_UDP_BATCH];
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctl[QBS_UDP_BATCH];
+
+  n = qbs_io_min(n, QBS_UDP_BATCH);
+  memset(hdrs, 0, sizeof(hdrs[0]) * n);
+  for (size_t i = 0; i < n; i++) {
+    iovs[i] = (struct iovec){.iov_base = msgs[i].buffer, .iov_len = msgs[i].size};
+    hdrs[i].msg_hdr = (struct msghdr){
+        .msg_name = &msgs[i].addr,
+        .msg_namelen = sizeof(msgs[i].addr),
+        .msg_iov = &iovs[i],
+        .msg_iovlen = 1,
+        .msg_control = ctl[i].buf,
+        .msg_controllen = sizeof(ctl[i].buf),
+    };
+  }
+
+  int res = syscall(SYS_recvmmsg, u->sock, hdrs, n, MSG_WAITFORONE | MSG_TRUNC, 0);
+  if (res == -1)
+    return 0;
+
+  for (int i = 0; i < res; i++) {
+    msgs[i].size = hdrs[i].msg_len;
+    msgs[i].addrlen = hdrs[i].msg_hdr.msg_namelen;
+    msgs[i].segment = 0;
+    msgs[i].truncated = (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+
+    struct cmsghdr *c;
+    for (c = CMSG_FIRSTHDR(&hdrs[i].msg_hdr); c != 0; c = CMSG_NXTHDR(&hdrs[i].msg_hdr, c)) {
+      if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+        int seg;
+        memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+        msgs[i].segment = seg;
+      }
+    }
+  }
+  return res;
+}
+
+QBSDEF uint64_t qbs_udp_send_batch(qbs_udp_t *u, qbs_udp_msg_t *msgs, uint64_t n) {
+  assert(u != 0);
+  assert(msgs != 0);
+  assert(n != 0);
+
+  qbs_mmsghdr_t hdrs[QBS_UDP_BATCH];
+  struct iovec iovs[QBS_UDP_BATCH];
+  union {
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr align;
+  } ctl[QBS_UDP_BATCH];
+
+  uint64_t ttl = 0;
+  while (ttl < n) {
+    uint64_t cnt = qbs_io_min(n - ttl, QBS_UDP_BATCH);
+    memset(hdrs, 0, sizeof(hdrs[0]) * cnt);
+
+    for (size_t i = 0; i < cnt; i++) {
+      qbs_udp_msg_t *m = &msgs[ttl + i];
+      iovs[i] = (struct iovec){.iov_base = m->buffer, .iov_len = m->size};
+      hdrs[i].msg_hdr.msg_iov = &iovs[i];
+      hdrs[i].msg_hdr.msg_iovlen = 1;
+
+      if (m->addrlen != 0) {
+        hdrs[i].msg_hdr.msg_name = &m->addr;
+        hdrs[i].msg_hdr.msg_namelen = m->addrlen;
+      }
+
+      if (m->segment != 0) {
+        hdrs[i].msg_hdr.msg_control = ctl[i].buf;
+        hdrs[i].msg_hdr.msg_controllen = sizeof(ctl[i].buf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&hdrs[i].msg_hdr);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(c), &m->segment, sizeof(uint16_t));
+      }
+    }
+
+    int res = syscall(SYS_sendmmsg, u->sock, hdrs, cnt, 0);
+    if (res == -1)
+      return ttl;
+    ttl += res;
+  }
+  return ttl;
+}
+
+QBSDEF bool qbs_udp_set_gso(qbs_udp_t *u, uint16_t segment) {
+  assert(u != 0);
+
+  int val = segment;
+  return setsockopt(u->sock, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0;
+}
+
+QBSDEF bool qbs_udp_set_gro(qbs_udp_t *u, bool enable) {
+  assert(u != 0);
+
+  int val = enable;
+  return setsockopt(u->sock, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0;
+}
+
+QBSDEF uint64_t qbs_bytes_read(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz) {
+  if (ctx->is_completed) {
+    errno = QBS_NOPROG;
+    return 0;
+  }
+
+  if (ctx->capacity == ctx->offset) {
+    ctx->is_completed = true;
+    errno = QBS_EOF;
+    return 0;
+  }
+
+  sz = qbs_io_min(sz, ctx->capacity - ctx->offset);
+  memcpy(b, ctx->buffer + ctx->offset, sz);
+  ctx->offset += sz;
+  return sz;
+}
+
+QBSDEF uint64_t qbs_bytes_write(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz) {
+  if (ctx->capacity - ctx->offset < sz) {
+    errno = QBS_TOSMALL;
+    return 0;
+  }
+
+  memcpy(ctx->buffer + ctx->offset, b, sz);
+  ctx->offset += sz;
+  return sz;
+}
+
+QBSDEF uint64_t qbs_bytes_read_at(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz, uint64_t off) {
+  if (off >= ctx->capacity) {
+    errno = QBS_EOF;
+    return 0;
+  }
+
+  sz = qbs_io_min(sz, ctx->capacity - off);
+  memcpy(b, ctx->buffer + off, sz);
+  return sz;
+}
+
+QBSDEF uint64_t qbs_bytes_write_at(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz, uint64_t off) {
+  if (off > ctx->capacity || ctx->capacity - off < sz) {
+    errno = QBS_TOSMALL;
+    return 0;
+  }
+
+  memcpy(ctx->buffer + off, b, sz);
+  return sz;
+}
+
+QBSDEF qbs_result_t qbs_bytes_writev(qbs_bytes_t *ctx, struct iovec *iov, int cnt) {
+  uint64_t sz = 0;
+  for (int i = 0; i < cnt; i++)
+    sz += iov[i].iov_len;
+
+  if (ctx->capacity - ctx->offset < sz)
+    return (qbs_result_t){.err = -QBS_TOSMALL};
+
+  for (int i = 0; i < cnt; i++) {
+    memcpy(ctx->buffer + ctx->offset, iov[i].iov_base, iov[i].iov_len);
+    ctx->offset += iov[i].iov_len;
+  }
+  return (qbs_result_t){.n = sz};
+}
+
+QBSDEF qbs_result_t qbs_bytes_read_result(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz) {
+  if (ctx->capacity == ctx->offset) {
+    ctx->is_completed = true;
+    return (qbs_result_t){.eof = true};
+  }
+
+  sz = qbs_io_min(sz, ctx->capacity - ctx->offset);
+  memcpy(b, ctx->buffer + ctx->offset, sz);
+  ctx->offset += sz;
+
+  // Completion is recorded on the next call, like the legacy reader, so a later io.read still gets EOF.
+  return (qbs_result_t){.n = sz, .eof = ctx->capacity == ctx->offset};
+}
+
+QBSDEF qbs_result_t qbs_bytes_write_result(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz) {
+  // Fills what is left of the buffer, so the caller knows how much of the data was kept.
+  uint64_t n = qbs_io_min(sz, ctx->capacity - ctx->offset);
+  memcpy(ctx->buffer + ctx->offset, b, n);
+  ctx->offset += n;
+  return (qbs_result_t){.n = n, .err = n == sz ? 0 : -QBS_TOSMALL};
+}
+
+QBSDEF bool qbs_bytes_reader(qbs_bytes_t *out, uint8_t *buffer, uint64_t size) {
+  assert(out != 0);
+  assert(buffer != 0);
+  assert(size != 0);
+
+  *out = (qbs_bytes_t){
+      .io =
+          {
+              .read = (qbs_io_read)qbs_bytes_read,
+              .write = qbs_io_invalid_rw,
+              .close = qbs_io_invalid_close,
+              .read_at = (qbs_io_read_at)qbs_bytes_read_at,
+              .read_result = (qbs_io_read_result)qbs_bytes_read_result,
+          },
+      .offset = 0,
+      .capacity = size,
+      .buffer = buffer,
+      .is_completed = false,
+  };
+  return true;
+}
+
+QBSDEF bool qbs_bytes_writer(qbs_bytes_t *out, uint8_t *buffer, uint64_t size) {
+  assert(out != 0);
+  assert(buffer != 0);
+  assert(size != 0);
+
+  *out = (qbs_bytes_t){
+      .io =
+          {
+              .read = qbs_io_invalid_rw,
+              .write = (qbs_io_write)qbs_bytes_write,
+              .close = qbs_io_invalid_close,
+              .write_at = (qbs_io_write_at)qbs_bytes_write_at,
+              .writev = (qbs_io_writev)qbs_bytes_writev,
+              .write_result = (qbs_io_write_result)qbs_bytes_write_result,
+          },
+      .offset = 0,
+      .capacity = size,
+      .buffer = buffer,
+      .is_completed = false,
+  };
+  return true;
+}
+
+// Encodes a frame length prefix into out, which must hold 10 bytes; returns the prefix size.
+QBSDEF uint64_t qbs_frame_encode(qbs_frame_prefix_t prefix, uint64_t sz, uint8_t *out) {
+  if (prefix == QBS_FRAME_FIXED32) {
+    out[0] = sz >> 24;
+    out[1] = sz >> 16;
+    out[2] = sz >> 8;
+    out[3] = sz;
+    return 4;
+  }
+
+  uint64_t n = 0;
+  while (sz >= 0x80) {
+    out[n++] = (sz & 0x7f) | 0x80;
+    sz >>= 7;
+  }
+  out[n++] = sz;
+  return n;
+}
+
+// Decodes a frame length prefix from b; returns the prefix size, or 0 if more bytes are needed.
+QBSDEF uint64_t qbs_frame_decode(qbs_frame_prefix_t prefix, uint8_t *b, uint64_t sz, uint64_t *out) {
+  if (prefix == QBS_FRAME_FIXED32) {
+    if (sz < 4)
+      return 0;
+    *out = (uint64_t)b[0] << 24 | (uint64_t)b[1] << 16 | (uint64_t)b[2] << 8 | b[3];
+    return 4;
+  }
+
+  uint64_t val = 0;
+  for (uint64_t i = 0; i < sz && i < 10; i++) {
+    val |= (uint64_t)(b[i] & 0x7f) << (7 * i);
+    if ((b[i] & 0x80) == 0) {
+      *out = val;
+      return i + 1;
+    }
+  }
+  if (sz >= 10) {
+    // Not a valid 64 bit varint, report it as an oversized frame.
+    *out = UINT64_MAX;
+    return 10;
+  }
+  return 0;
+}
+
+QBSDEF uint64_t qbs_frame_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+QBSDEF qbs_result_t qbs_frame_flush_result(qbs_frame_writer_t *fw) {
+  if (fw->len == 0)
+    return (qbs_result_t){0};
+
+  struct iovec iov = {.iov_base = fw->buffer, .iov_len = fw->len};
+  qbs_result_t res = qbs_io_result_write_iov(fw->w, &iov, 1);
+  if (res.err == 0) {
+    fw->len = 0;
+    return res;
+  }
+
+  // Whatever reached the writer is dropped, so a retried flush does not send it twice.
+  memmove(fw->buffer, fw->buffer + res.n, fw->len - res.n);
+  fw->len -= res.n;
+  return res;
+}
+
+QBSDEF bool qbs_frame_flush(qbs_frame_writer_t *fw) {
+  assert(fw != 0);
 
-QBSDEF uint64_t qbs_file_read(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
-  assert(ctx != 0);
-  assert(b != 0);
-  assert(ctx->mode == O_RDONLY || ctx->mode == O_RDWR);
-  assert(sz > 0);
+  qbs_result_t res = qbs_frame_flush_result(fw);
+  if (res.err != 0) {
+    qbs_result_set_errno(res);
+    return false;
+  }
+  return true;
+}
 
-  int64_t res = read(ctx->fd, b, sz);
-  if (res == 0) {
-    errno = QBS_EOF;
-    return 0;
+// Queues a frame; n is sz once the frame is queued or written.
+QBSDEF qbs_result_t qbs_frame_write_result(qbs_frame_writer_t *fw, uint8_t *b, uint64_t sz) {
+  assert(fw != 0);
+  assert(b != 0 || sz == 0);
+
+  if (sz > fw->max_frame)
+    return (qbs_result_t){.err = -QBS_TOBIG};
+
+  uint8_t head[10];
+  uint64_t hlen = qbs_frame_encode(fw->prefix, sz, head);
+
+  if (hlen + sz > fw->capacity - fw->len) {
+    if (hlen + sz > fw->capacity) {
+      // Too big to be gathered, send it along with everything queued in one gather write.
+      struct iovec iov[3] = {
+          {.iov_base = fw->buffer, .iov_len = fw->len},
+          {.iov_base = head, .iov_len = hlen},
+          {.iov_base = b, .iov_len = sz},
+      };
+      qbs_result_t res = qbs_io_result_write_iov(fw->w, iov, 3);
+      if (res.err != 0)
+        return (qbs_result_t){.err = res.err};
+      fw->len = 0;
+      return (qbs_result_t){.n = sz};
+    }
+    qbs_result_t res = qbs_frame_flush_result(fw);
+    if (res.err != 0)
+      return (qbs_result_t){.err = res.err};
   }
 
-  if (res < 0)
-    return 0;
+  if (fw->len == 0 && fw->flush_ns != 0)
+    fw->since = qbs_frame_now();
+
+  memcpy(fw->buffer + fw->len, head, hlen);
+  if (sz != 0)
+    memcpy(fw->buffer + fw->len + hlen, b, sz);
+  fw->len += hlen + sz;
+
+  // The frame is queued either way; a failed flush is reported along with n = sz, so it is not queued twice.
+  bool flush = (fw->flush_bytes != 0 && fw->len >= fw->flush_bytes) ||
+               (fw->flush_ns != 0 && qbs_frame_now() - fw->since >= fw->flush_ns);
+  if (flush) {
+    qbs_result_t res = qbs_frame_flush_result(fw);
+    if (res.err != 0)
+      return (qbs_result_t){.n = sz, .err = res.err};
+  }
+  return (qbs_result_t){.n = sz};
+}
 
-  return res;
+QBSDEF bool qbs_frame_write(qbs_frame_writer_t *fw, uint8_t *b, uint64_t sz) {
+  qbs_result_t res = qbs_frame_write_result(fw, b, sz);
+  if (res.err != 0 && res.n != sz) {
+    qbs_result_set_errno(res);
+    return false;
+  }
+  return true;
 }
 
-QBSDEF uint64_t qbs_file_write(qbs_file_t *ctx, uint8_t *b, uint64_t sz) {
-  assert(ctx != 0);
-  assert(b != 0);
-  assert(ctx->mode == O_WRONLY || ctx->mode == O_RDWR);
+QBSDEF uint64_t qbs_frame_writer_write(qbs_frame_writer_t *fw, uint8_t *b, uint64_t sz) {
   assert(sz > 0);
 
-  int64_t res = write(ctx->fd, b, sz);
-  if (res == -1)
+  if (!qbs_frame_write(fw, b, sz))
     return 0;
+  return sz;
+}
 
-  return res;
+QBSDEF bool qbs_frame_poll(qbs_frame_writer_t *fw, uint64_t *next) {
+  assert(fw != 0);
+
+  uint64_t wait = UINT64_MAX;
+  if (fw->len != 0 && fw->flush_ns != 0) {
+    uint64_t age = qbs_frame_now() - fw->since;
+    if (age >= fw->flush_ns) {
+      if (!qbs_frame_flush(fw))
+        return false;
+    } else {
+      wait = fw->flush_ns - age;
+    }
+  }
+
+  if (next != 0)
+    *next = wait;
+  return true;
 }
 
-QBSDEF bool qbs_file_open(qbs_file_t *out, const char *filename, int mode) {
-  int fd = open(filename, mode, 0644);
-  if (fd == -1)
-    return false;
+QBSDEF bool qbs_frame_writer(qbs_frame_writer_t *out, qbs_io_t *w, qbs_frame_prefix_t prefix, uint64_t max_frame, uint8_t *buffer,
+                             uint64_t size, uint64_t flush_bytes, uint64_t flush_ns) {
+  assert(out != 0);
+  assert(w != 0);
+  assert(buffer != 0);
+  assert(size != 0);
 
-  qbs_io_read rcb = (mode == O_RDWR || mode == O_RDONLY) ? (qbs_io_read)qbs_file_read : qbs_io_invalid_rw;
-  qbs_io_write wcb = (mode == O_RDWR || mode == O_WRONLY) ? (qbs_io_write)qbs_file_write : qbs_io_invalid_rw;
+  if (prefix == QBS_FRAME_FIXED32 && max_frame > UINT32_MAX) {
+    errno = QBS_TOBIG;
+    return false;
+  }
 
-  *out = (qbs_file_t){
+  *out = (qbs_frame_writer_t){
       .io =
           {
-              .read = rcb,
-              .write = wcb,
-              .close = (qbs_io_close)qbs_file_close,
+              .read = qbs_io_invalid_rw,
+              .write = (qbs_io_write)qbs_frame_writer_write,
+              .close = qbs_io_invalid_close,
+              .write_result = (qbs_io_write_result)qbs_frame_write_result,
           },
-      .filename = filename,
-      .mode = mode,
-      .fd = fd,
+      .w = w,
+      .prefix = prefix,
+      .max_frame = max_frame,
+      .buffer = buffer,
+      .capacity = size,
+      .len = 0,
+      .flush_bytes = flush_bytes,
+      .flush_ns = flush_ns,
+      .since = 0,
   };
   return true;
 }
 
-QBSDEF uint16_t qbs_tcp_close(qbs_sock_t *ctx) { return close(ctx->sock); }
+// Finds the next frame without consuming it; *used is set to the size of the frame, prefix included.
+// A frame was found unless err or eof is set in the result.
+QBSDEF qbs_result_t qbs_frame_peek(qbs_frame_reader_t *fr, uint8_t **frame, uint64_t *size, uint64_t *used) {
+  while (true) {
+    uint64_t avail = fr->end - fr->start;
+    uint64_t sz = 0;
+    uint64_t hlen = qbs_frame_decode(fr->prefix, fr->buffer + fr->start, avail, &sz);
+
+    if (hlen != 0 && sz > fr->max_frame)
+      return (qbs_result_t){.err = -QBS_TOBIG};
+    if (hlen != 0 && avail - hlen >= sz) {
+      *frame = fr->buffer + fr->start + hlen;
+      *size = sz;
+      *used = hlen + sz;
+      return (qbs_result_t){0};
+    }
 
-QBSDEF uint64_t qbs_tcp_read(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
-  assert(ctx != 0);
-  assert(b != 0);
+    // Make room for the rest of the frame before reading more.
+    if (avail == 0 || fr->end == fr->capacity || (hlen != 0 && fr->capacity - fr->start < hlen + sz)) {
+      memmove(fr->buffer, fr->buffer + fr->start, avail);
+      fr->start = 0;
+      fr->end = avail;
+    }
 
-  int64_t res = read(ctx->sock, b, sz);
-  if (res == 0) {
-    errno = QBS_EOF;
-    return 0;
+    qbs_result_t rr = qbs_io_result_read(fr->r, fr->buffer + fr->end, fr->capacity - fr->end);
+    fr->end += rr.n;
+    if (rr.err != 0)
+      return (qbs_result_t){.err = rr.err};
+    if (rr.eof && rr.n == 0)
+      return avail != 0 ? (qbs_result_t){.err = -QBS_UNXEOF} : (qbs_result_t){.eof = true};
   }
-  if (res == -1)
-    return 0;
-  return res;
 }
 
-QBSDEF uint64_t qbs_tcp_write(qbs_sock_t *ctx, uint8_t *b, uint64_t sz) {
-  assert(ctx != 0);
-  assert(b != 0);
+QBSDEF bool qbs_frame_next(qbs_frame_reader_t *fr, uint8_t **frame, uint64_t *size) {
+  assert(fr != 0);
+  assert(frame != 0);
+  assert(size != 0);
 
-  uint64_t ttl = sz;
-  while (sz != 0) {
-    int64_t res = write(ctx->sock, b, sz);
-    if (res == -1)
-      return 0;
-    sz -= res;
-    b += res;
+  uint64_t used = 0;
+  qbs_result_t res = qbs_frame_peek(fr, frame, size, &used);
+  if (res.err != 0 || res.eof) {
+    qbs_result_set_errno(res);
+    return false;
   }
-  return ttl;
+
+  fr->start += used;
+  return true;
 }
 
-QBSDEF bool qbs_tcp_dial(qbs_sock_t *out, const char *address, uint16_t port) {
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == -1)
-    return false;
+QBSDEF qbs_result_t qbs_frame_reader_read_result(qbs_frame_reader_t *fr, uint8_t *b, uint64_t sz) {
+  uint8_t *frame;
+  uint64_t n, used = 0;
+
+  // Zero-length frames carry nothing a reader can return, skip them.
+  do {
+    qbs_result_t res = qbs_frame_peek(fr, &frame, &n, &used);
+    if (res.err != 0 || res.eof)
+      return res;
+
+    if (n > sz)
+      return (qbs_result_t){.err = -QBS_TOSMALL};
+    fr->start += used;
+  } while (n == 0);
+
+  memcpy(b, frame, n);
+  return (qbs_result_t){.n = n};
+}
+
+QBSDEF uint64_t qbs_frame_reader_read(qbs_frame_reader_t *fr, uint8_t *b, uint64_t sz) {
+  return qbs_result_read_n(qbs_frame_reader_read_result(fr, b, sz));
+}
 
-  struct sockaddr_in seradr;
-  seradr.sin_family = AF_INET;
-  seradr.sin_port = htons(port);
-  inet_pton(AF_INET, address, &seradr.sin_addr);
+QBSDEF bool qbs_frame_reader(qbs_frame_reader_t *out, qbs_io_t *r, qbs_frame_prefix_t prefix, uint64_t max_frame, uint8_t *buffer,
+                             uint64_t size) {
+  assert(out != 0);
+  assert(r != 0);
+  assert(buffer != 0);
 
-  int res = connect(sock, (struct sockaddr *)&seradr, sizeof(seradr));
-  if (res != 0)
+  if (size < max_frame || size - max_frame < 10) {
+    errno = QBS_TOSMALL;
     return false;
+  }
 
-  *out = (qbs_sock_t){
+  *out = (qbs_frame_reader_t){
       .io =
           {
-              .read = (qbs_io_read)qbs_tcp_read,
-              .write = (qbs_io_write)qbs_tcp_write,
-              .close = (qbs_io_close)qbs_tcp_close,
+              .read = (qbs_io_read)qbs_frame_reader_read,
+              .write = qbs_io_invalid_rw,
+              .close = qbs_io_invalid_close,
+              .read_result = (qbs_io_read_result)qbs_frame_reader_read_result,
           },
-      .address = address,
-      .port = port,
-      .sock = sock,
+      .r = r,
+      .prefix = prefix,
+      .max_frame = max_frame,
+      .buffer = buffer,
+      .capacity = size,
+      .start = 0,
+      .end = 0,
   };
   return true;
 }
 
-QBSDEF bool qbs_tcp_listen(qbs_listener_t *out, const char *address, uint16_t port) {
-  int sock, res;
-  struct sockaddr_in addr;
-  int opt = 1;
+#define QBS_SHM_MAGIC 0x716273726e67ull // "qbsrng"
+#define QBS_SHM_HEADER 4096            // Size of the control block; keeps the ring storage page aligned.
+#define QBS_SHM_SPIN 1024              // Polls of the other end before sleeping on the futex.
 
-  sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == -1)
-    return false;
+// Control block at the start of the memfd. Producer and consumer fields live on separate cache lines.
+typedef struct {
+  uint64_t magic;
+  uint64_t capacity;
+  _Alignas(64) _Atomic uint64_t tail;  // Bytes committed by the writer.
+  _Atomic uint32_t data_seq;           // Futex word bumped when data is committed or the writer closes.
+  _Atomic uint32_t reader_waiting;     // True while the reader sleeps on data_seq.
+  _Atomic uint32_t writer_closed;
+  _Alignas(64) _Atomic uint64_t head;  // Bytes consumed by the reader.
+  _Atomic uint32_t space_seq;          // Futex word bumped when data is consumed or the reader closes.
+  _Atomic uint32_t writer_waiting;     // True while the writer sleeps on space_seq.
+  _Atomic uint32_t reader_closed;
+} qbs_shm_ring_t;
+
+QBSDEF void qbs_shm_futex_wait(_Atomic uint32_t *word, uint32_t val) {
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, val, 0, 0, 0);
+}
 
-  res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt));
-  if (res != 0) {
-    close(sock);
-    return false;
+QBSDEF void qbs_shm_futex_wake(_Atomic uint32_t *word) { syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, 1, 0, 0, 0); }
+
+// Blocks until *pos differs from old or *closed is set. The waiting flag lets the other end skip the wake
+// syscall while nobody sleeps, so the steady state only touches shared memory.
+QBSDEF void qbs_shm_wait(_Atomic uint64_t *pos, uint64_t old, _Atomic uint32_t *closed, _Atomic uint32_t *seq,
+                         _Atomic uint32_t *waiting) {
+  for (int i = 0; i < QBS_SHM_SPIN; i++)
+    if (atomic_load(pos) != old || atomic_load(closed))
+      return;
+
+  while (atomic_load(pos) == old && !atomic_load(closed)) {
+    uint32_t val = atomic_load(seq);
+    atomic_store(waiting, 1);
+    if (atomic_load(pos) == old && !atomic_load(closed))
+      qbs_shm_futex_wait(seq, val);
+    atomic_store(waiting, 0);
   }
+}
 
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(port);
-  inet_pton(AF_INET, address, &addr.sin_addr);
+QBSDEF void qbs_shm_notify(_Atomic uint32_t *seq, _Atomic uint32_t *waiting) {
+  atomic_fetch_add(seq, 1);
+  if (atomic_load(waiting))
+    qbs_shm_futex_wake(seq);
+}
 
-  res = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
-  if (res != 0) {
-    close(sock);
+QBSDEF bool qbs_shm_create(int *fd, uint64_t capacity) {
+  assert(fd != 0);
+  assert(capacity != 0);
+
+  uint64_t cap = QBS_SHM_HEADER;
+  while (cap < capacity)
+    cap <<= 1;
+
+  int mfd = syscall(SYS_memfd_create, "qbs-shm", 0);
+  if (mfd == -1)
     return false;
-  }
-  res = listen(sock, 4);
-  if (res != 0) {
-    close(sock);
+
+  void *map = MAP_FAILED;
+  if (ftruncate(mfd, QBS_SHM_HEADER + cap) == 0)
+    map = mmap(0, QBS_SHM_HEADER, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+  if (map == MAP_FAILED) {
+    int err = errno;
+    close(mfd);
+    errno = err;
     return false;
   }
-  *out = (qbs_listener_t){
-      .sock = sock,
-      .address = addr,
-  };
+
+  // The memfd is zero filled, only the identification fields need to be set.
+  qbs_shm_ring_t *ring = map;
+  ring->capacity = cap;
+  ring->magic = QBS_SHM_MAGIC;
+  munmap(map, QBS_SHM_HEADER);
+
+  *fd = mfd;
   return true;
 }
 
-QBSDEF bool qbs_tcp_accept(qbs_sock_t *out, qbs_listener_t *l) {
-  int addrlen = sizeof(l->address);
-  int sock = accept(l->sock, (struct sockaddr *)&l->address, (socklen_t *)&addrlen);
-  if (sock == -1) {
-    return false;
-  }
+QBSDEF uint16_t qbs_shm_reader_close(qbs_shm_t *ctx) {
+  qbs_shm_ring_t *ring = (qbs_shm_ring_t *)ctx->map;
+  atomic_store(&ring->reader_closed, 1);
+  atomic_fetch_add(&ring->space_seq, 1);
+  qbs_shm_futex_wake(&ring->space_seq);
+  return munmap(ctx->map, ctx->mapsize);
+}
 
-  *out = (qbs_sock_t){
-      .io =
-          {
-              .read = (qbs_io_read)qbs_tcp_read,
-              .write = (qbs_io_write)qbs_tcp_write,
-              .close = (qbs_io_close)qbs_tcp_close,
-          },
-      .sock = sock,
-  };
-  return true;
+QBSDEF uint16_t qbs_shm_writer_close(qbs_shm_t *ctx) {
+  qbs_shm_ring_t *ring = (qbs_shm_ring_t *)ctx->map;
+  atomic_store(&ring->writer_closed, 1);
+  atomic_fetch_add(&ring->data_seq, 1);
+  qbs_shm_futex_wake(&ring->data_seq);
+  return munmap(ctx->map, ctx->mapsize);
 }
 
-QBSDEF uint64_t qbs_bytes_read(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz) {
-  if (ctx->is_completed) {
-    errno = QBS_NOPROG;
-    return 0;
-  }
+QBSDEF qbs_result_t qbs_shm_read_result(qbs_shm_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+  assert(sz != 0);
 
-  if (ctx->capacity == ctx->offset) {
-    ctx->is_completed = true;
-    errno = QBS_EOF;
-    return 0;
+  qbs_shm_ring_t *ring = (qbs_shm_ring_t *)ctx->map;
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (tail == head) {
+    qbs_shm_wait(&ring->tail, head, &ring->writer_closed, &ring->data_seq, &ring->reader_waiting);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (tail == head)
+      return (qbs_result_t){.eof = true};
   }
 
-  sz = qbs_io_min(sz, ctx->capacity - ctx->offset);
-  for (size_t i = 0; i < sz; i++)
-    b[i] = ctx->buffer[ctx->offset++];
+  // The writer publishes its last bytes before closing, so a closed writer with nothing else committed means
+  // these bytes end the stream.
+  bool closed = atomic_load(&ring->writer_closed);
+  tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
 
-  return sz;
+  uint64_t off = head & (ctx->capacity - 1);
+  sz = qbs_io_min(sz, tail - head);
+  uint64_t first = qbs_io_min(sz, ctx->capacity - off);
+  memcpy(b, ctx->data + off, first);
+  memcpy(b + first, ctx->data, sz - first);
+
+  atomic_store_explicit(&ring->head, head + sz, memory_order_release);
+  qbs_shm_notify(&ring->space_seq, &ring->writer_waiting);
+  return (qbs_result_t){.n = sz, .eof = closed && head + sz == tail};
 }
 
-QBSDEF uint64_t qbs_bytes_write(qbs_bytes_t *ctx, uint8_t *b, uint64_t sz) {
-  if (ctx->capacity - ctx->offset < sz) {
-    errno = QBS_TOSMALL;
+QBSDEF uint64_t qbs_shm_read(qbs_shm_t *ctx, uint8_t *b, uint64_t sz) { return qbs_result_read_n(qbs_shm_read_result(ctx, b, sz)); }
+
+QBSDEF uint8_t *qbs_shm_reserve(qbs_shm_t *w, uint64_t *size) {
+  assert(w != 0);
+  assert(size != 0);
+  assert(*size != 0);
+
+  qbs_shm_ring_t *ring = (qbs_shm_ring_t *)w->map;
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  while (tail - head == w->capacity && !atomic_load(&ring->reader_closed)) {
+    qbs_shm_wait(&ring->head, head, &ring->reader_closed, &ring->space_seq, &ring->writer_waiting);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  }
+  if (atomic_load(&ring->reader_closed)) {
+    errno = EPIPE;
     return 0;
   }
 
-  for (size_t i = 0; i < sz; i++)
-    ctx->buffer[ctx->offset++] = b[i];
-  return sz;
+  uint64_t off = tail & (w->capacity - 1);
+  *size = qbs_io_min(*size, qbs_io_min(w->capacity - (tail - head), w->capacity - off));
+  return w->data + off;
 }
 
-QBSDEF bool qbs_bytes_reader(qbs_bytes_t *out, uint8_t *buffer, uint64_t size) {
-  assert(out != 0);
-  assert(buffer != 0);
-  assert(size != 0);
+QBSDEF bool qbs_shm_commit(qbs_shm_t *w, uint64_t n) {
+  assert(w != 0);
 
-  *out = (qbs_bytes_t){
-      .io =
-          {
-              .read = (qbs_io_read)qbs_bytes_read,
-              .write = qbs_io_invalid_rw,
-              .close = qbs_io_invalid_close,
-          },
-      .offset = 0,
-      .capacity = size,
-      .buffer = buffer,
-      .is_completed = false,
-  };
+  qbs_shm_ring_t *ring = (qbs_shm_ring_t *)w->map;
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (n > w->capacity - (tail - head)) {
+    errno = QBS_TOBIG;
+    return false;
+  }
+
+  atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+  qbs_shm_notify(&ring->data_seq, &ring->reader_waiting);
   return true;
 }
 
-QBSDEF bool qbs_bytes_writer(qbs_bytes_t *out, uint8_t *buffer, uint64_t size) {
+QBSDEF qbs_result_t qbs_shm_write_result(qbs_shm_t *ctx, uint8_t *b, uint64_t sz) {
+  assert(ctx != 0);
+  assert(b != 0);
+
+  qbs_result_t r = {0};
+  while (r.n < sz) {
+    uint64_t n = sz - r.n;
+    uint8_t *dst = qbs_shm_reserve(ctx, &n);
+    if (dst == 0) {
+      r.err = errno;
+      break;
+    }
+
+    memcpy(dst, b + r.n, n);
+    qbs_shm_commit(ctx, n);
+    r.n += n;
+  }
+  return r;
+}
+
+QBSDEF uint64_t qbs_shm_write(qbs_shm_t *ctx, uint8_t *b, uint64_t sz) { return qbs_result_write_n(qbs_shm_write_result(ctx, b, sz)); }
+
+QBSDEF bool qbs_shm_open(qbs_shm_t *out, int fd, bool writer) {
   assert(out != 0);
-  assert(buffer != 0);
-  assert(size != 0);
 
-  *out = (qbs_bytes_t){
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  if ((uint64_t)st.st_size <= QBS_SHM_HEADER) {
+    errno = EINVAL;
+    return false;
+  }
+
+  uint8_t *map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return false;
+
+  qbs_shm_ring_t *ring = (qbs_shm_ring_t *)map;
+  if (ring->magic != QBS_SHM_MAGIC || ring->capacity != (uint64_t)st.st_size - QBS_SHM_HEADER) {
+    munmap(map, st.st_size);
+    errno = EINVAL;
+    return false;
+  }
+
+  *out = (qbs_shm_t){
       .io =
           {
-              .read = qbs_io_invalid_rw,
-              .write = (qbs_io_write)qbs_bytes_write,
-              .close = qbs_io_invalid_close,
+              .read = writer ? qbs_io_invalid_rw : (qbs_io_read)qbs_shm_read,
+              .write = writer ? (qbs_io_write)qbs_shm_write : qbs_io_invalid_rw,
+              .read_result = writer ? 0 : (qbs_io_read_result)qbs_shm_read_result,
+              .write_result = writer ? (qbs_io_write_result)qbs_shm_write_result : 0,
+              .close = writer ? (qbs_io_close)qbs_shm_writer_close : (qbs_io_close)qbs_shm_reader_close,
           },
-      .offset = 0,
-      .capacity = size,
-      .buffer = buffer,
-      .is_completed = false,
+      .fd = fd,
+      .map = map,
+      .mapsize = st.st_size,
+      .data = map + QBS_SHM_HEADER,
+      .capacity = ring->capacity,
   };
   return true;
 }
 
+QBSDEF bool qbs_shm_reader(qbs_shm_t *out, int fd) { return qbs_shm_open(out, fd, false); }
+
+QBSDEF bool qbs_shm_writer(qbs_shm_t *out, int fd) { return qbs_shm_open(out, fd, true); }
+
 QBSDEF bool qbs_http_get(qbs_sock_t *out, const char *address, uint16_t port, const char *route, uint16_t rsz, const char *header, uint32_t hsz) {
   uint64_t r;
 
@@ -713,6 +3792,8 @@ QBSDEF bool qbs_http_get(qbs_sock_t *out, const char *address, uint16_t port, co
     goto err;
 
   out->io.write = qbs_io_invalid_rw;
+  out->io.write_result = 0;
+  out->io.writev = 0;
   return true;
 
 err:
@@ -751,6 +3832,8 @@ QBSDEF bool qbs_http_post(qbs_sock_t *out, const char *address, uint16_t port, c
     goto err;
 
   out->io.write = qbs_io_invalid_rw;
+  out->io.write_result = 0;
+  out->io.writev = 0;
   return true;
 
 err:
@@ -758,4 +3841,145 @@ err:
   return false;
 }
 
+// Resolves the file behind a stream source that the kernel can copy from directly.
+QBSDEF qbs_file_t *qbs_io_src_file(qbs_io_t *src) {
+  if (src->read == (qbs_io_read)qbs_file_read)
+    return (qbs_file_t *)src;
+  return 0;
+}
+
+// Resolves the file behind a stream sink that copy_file_range can write to.
+QBSDEF qbs_file_t *qbs_io_dst_file(qbs_io_t *dst) {
+  if (dst->write == (qbs_io_write)qbs_file_write)
+    return (qbs_file_t *)dst;
+  return 0;
+}
+
+// Resolves the file descriptor backing a stream sink that sendfile can write to.
+QBSDEF int qbs_io_dst_fd(qbs_io_t *dst) {
+  if (dst->write == (qbs_io_write)qbs_file_write)
+    return ((qbs_file_t *)dst)->fd;
+  if (dst->write == (qbs_io_write)qbs_tcp_write || dst->write == (qbs_io_write)qbs_tcp_write_zc_sync)
+    return ((qbs_sock_t *)dst)->sock;
+  if (dst->write == (qbs_io_write)qbs_unix_write && ((qbs_unix_t *)dst)->type == SOCK_STREAM)
+    return ((qbs_unix_t *)dst)->sock;
+  return -1;
+}
+
+// Moves up to rem bytes from in to out with copy_file_range (range) or sendfile. fout is the file behind out, if
+// any; slices are cut to the qbs_file_behind windows so both files release their page cache as they stream.
+// Returns -1 if the pair is not supported and nothing was moved, 0 on error and 1 on success.
+QBSDEF int qbs_io_kernel_copy(qbs_file_t *in, int out, qbs_file_t *fout, uint64_t rem, bool range, uint64_t *ttl) {
+  uint64_t slice = 1 << 30;
+  if (in->behind != 0)
+    slice = qbs_io_min(slice, in->behind);
+  if (fout != 0 && fout->behind != 0)
+    slice = qbs_io_min(slice, fout->behind);
+
+  *ttl = 0;
+  while (*ttl < rem) {
+    size_t n = qbs_io_min(rem - *ttl, slice);
+    int64_t res = range ? syscall(SYS_copy_file_range, in->fd, 0, out, 0, n, 0) : sendfile(out, in->fd, 0, n);
+    if (res == -1 && *ttl == 0 &&
+        (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+      return -1;
+    if (res == -1)
+      return 0;
+    if (res == 0)
+      break;
+    *ttl += res;
+
+    if (in->behind != 0)
+      qbs_file_behind_advance(in, res, false);
+    if (fout != 0 && fout->behind != 0)
+      qbs_file_behind_advance(fout, res, true);
+  }
+  return 1;
+}
+
+// Copies between kernel objects without a user space buffer; handled is false if the pair is not supported.
+// Kept out of line: inlined into a caller holding a known adapter, the fd lookups of the other adapters would
+// read that object through the wrong type and trip -Warray-bounds.
+static QBS_NOINLINE qbs_result_t qbs_io_copy_fast(qbs_io_t *src, qbs_io_t *dst, bool *handled) {
+  qbs_limit_t *ltx = 0;
+  uint64_t rem = UINT64_MAX;
+
+  *handled = false;
+  if (src->read == (qbs_io_read)qbs_io_limit_read) {
+    ltx = (qbs_limit_t *)src;
+    if (ltx->is_completed)
+      return (qbs_result_t){0};
+    rem = ltx->limit - ltx->done;
+    src = ltx->r;
+  }
+
+  qbs_file_t *in = qbs_io_src_file(src);
+  if (in == 0)
+    return (qbs_result_t){0};
+
+  // copy_file_range lets the filesystem reflink or copy server side; sendfile still avoids user space.
+  uint64_t ttl = 0;
+  int res = -1;
+  qbs_file_t *fout = qbs_io_dst_file(dst);
+  if (fout != 0)
+    res = qbs_io_kernel_copy(in, fout->fd, fout, rem, true, &ttl);
+  int out = qbs_io_dst_fd(dst);
+  if (res == -1 && out != -1)
+    res = qbs_io_kernel_copy(in, out, fout, rem, false, &ttl);
+  if (res == -1)
+    return (qbs_result_t){0};
+
+  *handled = true;
+  if (ltx != 0)
+    ltx->done += ttl;
+  if (res == 0)
+    return (qbs_result_t){.n = ttl, .err = errno};
+
+  if (ltx != 0)
+    ltx->is_completed = true;
+  return (qbs_result_t){.n = ttl, .eof = true};
+}
+
+QBS_DEFINE_TYPED_COPY(qbs_copy_bytes_bytes, qbs_bytes_t, qbs_bytes_read, qbs_bytes_t, qbs_bytes_write)
+QBS_DEFINE_TYPED_COPY(qbs_copy_bytes_file, qbs_bytes_t, qbs_bytes_read, qbs_file_t, qbs_file_write)
+QBS_DEFINE_TYPED_COPY(qbs_copy_file_bytes, qbs_file_t, qbs_file_read, qbs_bytes_t, qbs_bytes_write)
+QBS_DEFINE_TYPED_COPY(qbs_copy_bytes_sock, qbs_bytes_t, qbs_bytes_read, qbs_sock_t, qbs_tcp_write)
+QBS_DEFINE_TYPED_COPY(qbs_copy_sock_bytes, qbs_sock_t, qbs_tcp_read, qbs_bytes_t, qbs_bytes_write)
+QBS_DEFINE_LIMIT_READ(qbs_io_limit_read_bytes, qbs_bytes_t, qbs_bytes_read)
+QBS_DEFINE_COPY(qbs_copy_limit_bytes_kernel, qbs_limit_t, qbs_io_limit_read_bytes, qbs_bytes_t, qbs_bytes_write)
+
+QBSDEF uint64_t qbs_copy_limit_bytes(qbs_limit_t *src, qbs_bytes_t *dst, uint8_t *buf, uint64_t sz) {
+  if (src->io.read != (qbs_io_read)qbs_io_limit_read || src->r->read != (qbs_io_read)qbs_bytes_read ||
+      dst->io.write != (qbs_io_write)qbs_bytes_write)
+    return qbs_io_copy_buffer(&src->io, &dst->io, buf, sz);
+  return qbs_copy_limit_bytes_kernel(src, dst, buf, sz);
+}
+
+QBSDEF uint64_t qbs_copy_io_io(void *src, void *dst, uint8_t *buf, uint64_t sz) { return qbs_io_copy_buffer(src, dst, buf, sz); }
+
+// Routes pairs of known adapters to their specialized copy function; handled is false for any other pair.
+// Out of line for the same reason as qbs_io_copy_fast: the kernels cast to every adapter type.
+static QBS_NOINLINE uint64_t qbs_io_copy_static(qbs_io_t *src, qbs_io_t *dst, uint8_t *buf, uint64_t sz, bool *handled) {
+  qbs_io_read r = src->read;
+  qbs_io_write w = dst->write;
+
+  *handled = true;
+  if (r == (qbs_io_read)qbs_bytes_read && w == (qbs_io_write)qbs_bytes_write)
+    return qbs_copy_bytes_bytes_kernel((qbs_bytes_t *)src, (qbs_bytes_t *)dst, buf, sz);
+  if (r == (qbs_io_read)qbs_bytes_read && w == (qbs_io_write)qbs_file_write)
+    return qbs_copy_bytes_file_kernel((qbs_bytes_t *)src, (qbs_file_t *)dst, buf, sz);
+  if (r == (qbs_io_read)qbs_file_read && w == (qbs_io_write)qbs_bytes_write)
+    return qbs_copy_file_bytes_kernel((qbs_file_t *)src, (qbs_bytes_t *)dst, buf, sz);
+  if (r == (qbs_io_read)qbs_bytes_read && w == (qbs_io_write)qbs_tcp_write)
+    return qbs_copy_bytes_sock_kernel((qbs_bytes_t *)src, (qbs_sock_t *)dst, buf, sz);
+  if (r == (qbs_io_read)qbs_tcp_read && w == (qbs_io_write)qbs_bytes_write)
+    return qbs_copy_sock_bytes_kernel((qbs_sock_t *)src, (qbs_bytes_t *)dst, buf, sz);
+  if (r == (qbs_io_read)qbs_io_limit_read && w == (qbs_io_write)qbs_bytes_write &&
+      ((qbs_limit_t *)src)->r->read == (qbs_io_read)qbs_bytes_read)
+    return qbs_copy_limit_bytes_kernel((qbs_limit_t *)src, (qbs_bytes_t *)dst, buf, sz);
+
+  *handled = false;
+  return 0;
+}
+
 #endif